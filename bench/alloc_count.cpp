@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+//------------------------------------------------------------------------------
+/*
+    Allocation counter
+
+    A library for LD_PRELOAD which counts calls to malloc, calloc
+    and realloc in the process. Sending it SIGUSR1 prints the count
+    so far to standard error, so the allocations made while
+    serving a known amount of traffic can be measured:
+
+        LD_PRELOAD=./liblounge-alloc-count.so lounge-server ...
+        kill -USR1 <pid>
+        lounge-replay ...
+        kill -USR1 <pid>
+
+    This works with glibc only.
+*/
+//------------------------------------------------------------------------------
+
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <unistd.h>
+
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* __libc_calloc(std::size_t n, std::size_t size);
+extern "C" void* __libc_realloc(void* p, std::size_t size);
+
+namespace {
+
+std::atomic<unsigned long long> count{0};
+
+void
+report(int)
+{
+    // Only async-signal-safe calls may be used here
+    char buf[48] = "allocations: ";
+    char digits[24];
+    auto n = count.load(std::memory_order_relaxed);
+    std::size_t len = 0;
+    do
+    {
+        digits[len++] = static_cast<char>('0' + n % 10);
+        n /= 10;
+    }
+    while(n > 0);
+    std::size_t pos = 13;
+    while(len > 0)
+        buf[pos++] = digits[--len];
+    buf[pos++] = '\n';
+    auto const written = ::write(2, buf, pos);
+    (void)written;
+}
+
+__attribute__((constructor))
+void
+install()
+{
+    std::signal(SIGUSR1, &report);
+}
+
+} // namespace
+
+extern "C"
+void*
+malloc(std::size_t size)
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C"
+void*
+calloc(std::size_t n, std::size_t size)
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+extern "C"
+void*
+realloc(void* p, std::size_t size)
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+//------------------------------------------------------------------------------
+/*
+    HTTP microbenchmark
+
+    Opens a number of keep-alive connections to a running server
+    and requests the same target on each as fast as the responses
+    arrive, then reports requests per second. Use a small file to
+    measure the file path, or a missing one for error responses.
+*/
+//------------------------------------------------------------------------------
+
+#include "beast.hpp"
+#include "net.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using clock_type = std::chrono::steady_clock;
+
+// Totals gathered across all connections
+struct stats
+{
+    std::uint64_t requests = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t errors = 0;
+};
+
+// One keep-alive connection issuing requests back to back
+class connection : public std::enable_shared_from_this<connection>
+{
+    tcp::socket socket_;
+    beast::flat_buffer buffer_;
+    http::request<http::empty_body> req_;
+    http::response<http::string_body> res_;
+    clock_type::time_point end_;
+    stats& stats_;
+
+    void
+    fail(error_code ec, char const* what)
+    {
+        ++stats_.errors;
+        std::cerr << what << ": " << ec.message() << "\n";
+    }
+
+    void
+    on_connect(error_code ec)
+    {
+        if(ec)
+            return fail(ec, "connect");
+        socket_.set_option(tcp::no_delay(true), ec);
+        do_write();
+    }
+
+    void
+    do_write()
+    {
+        http::async_write(socket_, req_,
+            [self = shared_from_this()](error_code ec, std::size_t)
+            {
+                if(ec)
+                    return self->fail(ec, "write");
+                self->do_read();
+            });
+    }
+
+    void
+    do_read()
+    {
+        res_ = {};
+        http::async_read(socket_, buffer_, res_,
+            [self = shared_from_this()](error_code ec, std::size_t bytes)
+            {
+                self->on_read(ec, bytes);
+            });
+    }
+
+    void
+    on_read(error_code ec, std::size_t bytes)
+    {
+        if(ec)
+            return fail(ec, "read");
+
+        ++stats_.requests;
+        stats_.bytes += bytes;
+
+        if(clock_type::now() < end_ && res_.keep_alive())
+            do_write();
+        else
+            socket_.shutdown(tcp::socket::shutdown_both, ec);
+    }
+
+public:
+    connection(
+        net::io_context& ioc,
+        std::string const& target,
+        clock_type::time_point end,
+        stats& st)
+        : socket_(ioc)
+        , end_(end)
+        , stats_(st)
+    {
+        req_.method(http::verb::get);
+        req_.target(target);
+        req_.version(11);
+        req_.set(http::field::host, "localhost");
+    }
+
+    void
+    run(tcp::endpoint const& ep)
+    {
+        socket_.async_connect(ep,
+            [self = shared_from_this()](error_code ec)
+            {
+                self->on_connect(ec);
+            });
+    }
+};
+
+int
+main(int argc, char* argv[])
+{
+    // Check command line arguments.
+    if (argc < 4 || argc > 6)
+    {
+        std::cerr <<
+            "Usage: lounge-bench <address> <port> <target> [<connections> [<seconds>]]\n" <<
+            "Example:\n" <<
+            "    lounge-bench 127.0.0.1 8080 /chat_client.html\n" <<
+            "    lounge-bench 127.0.0.1 8080 /missing.html 16 10\n";
+        return EXIT_FAILURE;
+    }
+    auto address = net::ip::make_address(argv[1]);
+    auto port = static_cast<unsigned short>(std::atoi(argv[2]));
+    std::string target = argv[3];
+    auto connections = argc > 4 ? std::atoi(argv[4]) : 8;
+    auto seconds = argc > 5 ? std::atof(argv[5]) : 5.0;
+
+    net::io_context ioc;
+    stats st;
+    auto const start = clock_type::now();
+    auto const end = start + std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(seconds));
+
+    for(int i = 0; i < connections; ++i)
+        std::make_shared<connection>(ioc, target, end, st)->run(
+            tcp::endpoint{address, port});
+    ioc.run();
+
+    auto const elapsed =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+    std::cout <<
+        "target:     " << target << "\n" <<
+        "requests:   " << st.requests << " in " << elapsed << "s over " <<
+            connections << " connections\n" <<
+        "throughput: " << st.requests / elapsed << " req/s, " <<
+            st.bytes / elapsed / (1024 * 1024) << " MiB/s\n" <<
+        "errors:     " << st.errors << "\n";
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,422 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+//------------------------------------------------------------------------------
+/*
+    Traffic replay
+
+    Drives a running server with the connects, disconnects, and
+    messages of a capture file, at the recorded pace or faster,
+    then reports throughput and delivery latency.
+
+    Each message is a JSON object of the recorded size holding the
+    time it was sent, so latency is measured for every copy which
+    a client receives, including those inside batches.
+*/
+//------------------------------------------------------------------------------
+
+#include "beast.hpp"
+#include "net.hpp"
+#include "recorder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+// Totals gathered across all clients
+struct stats
+{
+    std::uint64_t sent = 0;
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t received = 0;
+    std::uint64_t bytes_received = 0;
+    std::vector<std::int64_t> latency;  // microseconds
+    clock_type::time_point last_sent;
+    clock_type::time_point last_received;
+};
+
+// Build a message of at least `size` bytes stamped with the current time
+std::string
+make_message(std::uint64_t size)
+{
+    auto const now = std::chrono::duration_cast<std::chrono::microseconds>(
+        clock_type::now().time_since_epoch()).count();
+    std::string s = "{\"t\":" + std::to_string(now) + ",\"p\":\"";
+    if(s.size() + 2 < size)
+        s.append(static_cast<std::size_t>(size) - s.size() - 2, 'x');
+    s.append("\"}");
+    return s;
+}
+
+//------------------------------------------------------------------------------
+
+// One simulated user
+class client : public std::enable_shared_from_this<client>
+{
+    websocket::stream<tcp::socket> ws_;
+    beast::flat_buffer buffer_;
+    stats& stats_;
+    std::vector<std::string> queue_;
+    bool open_ = false;
+    bool closing_ = false;
+
+    void
+    fail(error_code ec, char const* what)
+    {
+        if( ec == net::error::operation_aborted ||
+            ec == websocket::error::closed)
+            return;
+        std::cerr << what << ": " << ec.message() << "\n";
+    }
+
+    void
+    on_connect(error_code ec)
+    {
+        if(ec)
+            return fail(ec, "connect");
+
+        // Don't let the harness add its own send delay to the latency
+        ws_.next_layer().set_option(tcp::no_delay(true), ec);
+
+        ws_.async_handshake("localhost", "/",
+            [self = shared_from_this()](error_code ec)
+            {
+                self->on_handshake(ec);
+            });
+    }
+
+    void
+    on_handshake(error_code ec)
+    {
+        if(ec)
+            return fail(ec, "handshake");
+
+        open_ = true;
+        do_read();
+
+        // Send what was queued while connecting
+        if(! queue_.empty())
+            do_write();
+        else if(closing_)
+            do_close();
+    }
+
+    void
+    do_read()
+    {
+        ws_.async_read(
+            buffer_,
+            [self = shared_from_this()](
+                error_code ec, std::size_t bytes)
+            {
+                self->on_read(ec, bytes);
+            });
+    }
+
+    void
+    on_read(error_code ec, std::size_t bytes)
+    {
+        if(ec)
+            return fail(ec, "read");
+
+        // Measure each message in the frame, which may be a batch
+        auto const now = std::chrono::duration_cast<std::chrono::microseconds>(
+            clock_type::now().time_since_epoch()).count();
+        auto const s = beast::buffers_to_string(buffer_.data());
+        for(auto pos = s.find("{\"t\":");
+            pos != std::string::npos;
+            pos = s.find("{\"t\":", pos + 1))
+        {
+            auto const sent = std::strtoll(s.c_str() + pos + 5, nullptr, 10);
+            stats_.latency.push_back(now - sent);
+            ++stats_.received;
+        }
+        stats_.bytes_received += bytes;
+        stats_.last_received = clock_type::now();
+        buffer_.consume(buffer_.size());
+
+        do_read();
+    }
+
+    void
+    do_write()
+    {
+        ws_.async_write(
+            net::buffer(queue_.front()),
+            [self = shared_from_this()](
+                error_code ec, std::size_t bytes)
+            {
+                self->on_write(ec, bytes);
+            });
+    }
+
+    void
+    on_write(error_code ec, std::size_t bytes)
+    {
+        if(ec)
+            return fail(ec, "write");
+
+        ++stats_.sent;
+        stats_.bytes_sent += bytes;
+        stats_.last_sent = clock_type::now();
+        queue_.erase(queue_.begin());
+
+        if(! queue_.empty())
+            do_write();
+        else if(closing_)
+            do_close();
+    }
+
+    void
+    do_close()
+    {
+        ws_.async_close(websocket::close_code::normal,
+            [self = shared_from_this()](error_code ec)
+            {
+                if(ec)
+                    self->fail(ec, "close");
+            });
+    }
+
+public:
+    client(net::io_context& ioc, stats& st)
+        : ws_(ioc)
+        , stats_(st)
+    {
+    }
+
+    void
+    run(tcp::endpoint const& ep)
+    {
+        ws_.next_layer().async_connect(ep,
+            [self = shared_from_this()](error_code ec)
+            {
+                self->on_connect(ec);
+            });
+    }
+
+    void
+    send(std::uint64_t size)
+    {
+        if(closing_)
+            return;
+        queue_.push_back(make_message(size));
+        if(open_ && queue_.size() == 1)
+            do_write();
+    }
+
+    void
+    close()
+    {
+        if(closing_)
+            return;
+        closing_ = true;
+        if(open_ && queue_.empty())
+            do_close();
+    }
+};
+
+//------------------------------------------------------------------------------
+
+// Schedules the recorded events
+class driver : public std::enable_shared_from_this<driver>
+{
+    net::io_context& ioc_;
+    tcp::endpoint ep_;
+    std::vector<recorder::event> events_;
+    double speed_;
+    stats& stats_;
+    net::steady_timer timer_;
+    clock_type::time_point start_;
+    std::size_t index_ = 0;
+    std::unordered_map<std::uint64_t, std::shared_ptr<client>> clients_;
+
+    clock_type::time_point
+    due(recorder::event const& e) const
+    {
+        return start_ + std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double, std::micro>(e.time.count() / speed_));
+    }
+
+    void
+    on_timer()
+    {
+        // Perform every event which is due
+        auto const now = clock_type::now();
+        for(; index_ < events_.size() && due(events_[index_]) <= now; ++index_)
+        {
+            auto const& e = events_[index_];
+            switch(e.kind)
+            {
+            case recorder::type::connect:
+            {
+                auto c = std::make_shared<client>(ioc_, stats_);
+                c->run(ep_);
+                clients_[e.session] = c;
+                break;
+            }
+
+            case recorder::type::disconnect:
+            {
+                auto it = clients_.find(e.session);
+                if(it != clients_.end())
+                {
+                    it->second->close();
+                    clients_.erase(it);
+                }
+                break;
+            }
+
+            case recorder::type::message:
+            {
+                auto it = clients_.find(e.session);
+                if(it != clients_.end())
+                    it->second->send(e.size);
+                break;
+            }
+            }
+        }
+
+        if(index_ < events_.size())
+            return next();
+
+        // Let the last messages arrive, then close everyone
+        timer_.expires_after(std::chrono::seconds(1));
+        timer_.async_wait(
+            [self = shared_from_this()](error_code)
+            {
+                for(auto& c : self->clients_)
+                    c.second->close();
+                self->clients_.clear();
+            });
+    }
+
+    void
+    next()
+    {
+        timer_.expires_at(due(events_[index_]));
+        timer_.async_wait(
+            [self = shared_from_this()](error_code ec)
+            {
+                if(! ec)
+                    self->on_timer();
+            });
+    }
+
+public:
+    driver(
+        net::io_context& ioc,
+        tcp::endpoint ep,
+        std::vector<recorder::event> events,
+        double speed,
+        stats& st)
+        : ioc_(ioc)
+        , ep_(ep)
+        , events_(std::move(events))
+        , speed_(speed)
+        , stats_(st)
+        , timer_(ioc)
+    {
+    }
+
+    void
+    run()
+    {
+        start_ = clock_type::now();
+        if(! events_.empty())
+            next();
+    }
+};
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char* argv[])
+{
+    // Check command line arguments.
+    if (argc < 4 || argc > 5)
+    {
+        std::cerr <<
+            "Usage: lounge-replay <address> <port> <capture_path> [<speed>]\n" <<
+            "Example:\n" <<
+            "    lounge-replay 127.0.0.1 8080 traffic.cap\n" <<
+            "    lounge-replay 127.0.0.1 8080 traffic.cap 10\n";
+        return EXIT_FAILURE;
+    }
+    auto address = net::ip::make_address(argv[1]);
+    auto port = static_cast<unsigned short>(std::atoi(argv[2]));
+    auto speed = argc > 4 ? std::atof(argv[4]) : 1.0;
+    if(speed <= 0)
+    {
+        std::cerr << "speed must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    error_code ec;
+    auto events = recorder::read(argv[3], ec);
+    if(ec)
+    {
+        std::cerr << "read: " << ec.message() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    net::io_context ioc;
+    stats st;
+    auto const start = clock_type::now();
+    auto const duration = events.empty() ?
+        std::chrono::microseconds(0) : events.back().time;
+    auto const count = events.size();
+
+    std::make_shared<driver>(
+        ioc, tcp::endpoint{address, port},
+        std::move(events), speed, st)->run();
+    ioc.run();
+
+    // Report rates over the time until the last message was sent, and
+    // until the last one arrived, excluding the wait for stragglers
+    auto const seconds =
+        [start](clock_type::time_point t)
+        {
+            return std::max(
+                std::chrono::duration<double>(t - start).count(), 1e-6);
+        };
+    auto const send_time = seconds(st.last_sent);
+    auto const receive_time = seconds(st.last_received);
+    std::sort(st.latency.begin(), st.latency.end());
+    auto const percentile =
+        [&st](double p) -> std::int64_t
+        {
+            if(st.latency.empty())
+                return 0;
+            auto const i = static_cast<std::size_t>(p * (st.latency.size() - 1));
+            return st.latency[i];
+        };
+
+    std::cout <<
+        "events:     " << count << " over " <<
+            std::chrono::duration<double>(duration).count() << "s recorded, " <<
+            speed << "x\n" <<
+        "sent:       " << st.sent << " messages, " << st.bytes_sent << " bytes in " <<
+            send_time << "s, " << st.sent / send_time << " msg/s\n" <<
+        "received:   " << st.received << " messages, " << st.bytes_received << " bytes in " <<
+            receive_time << "s, " << st.received / receive_time << " msg/s\n" <<
+        "latency us: p50 " << percentile(0.50) <<
+            " p90 " << percentile(0.90) <<
+            " p99 " << percentile(0.99) <<
+            " max " << percentile(1.0) << "\n";
+
+    return EXIT_SUCCESS;
+}
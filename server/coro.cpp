@@ -0,0 +1,51 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "coro.hpp"
+
+#if LOUNGE_COROUTINES
+
+#include "size_pool.hpp"
+#include <new>
+
+namespace {
+
+// Size classes are powers of two from 64 bytes to 8 KiB
+std::size_t constexpr class_count = 8;
+
+size_pool&
+local_pool() noexcept
+{
+    thread_local size_pool p(class_count);
+    return p;
+}
+
+} // namespace
+
+void*
+allocate_frame(std::size_t size)
+{
+    auto& pool = local_pool();
+    auto const cls = pool.size_class(size);
+    if(cls == pool.class_count())
+        return ::operator new(size);
+    return pool.allocate(cls);
+}
+
+void
+deallocate_frame(void* p, std::size_t size) noexcept
+{
+    auto& pool = local_pool();
+    auto const cls = pool.size_class(size);
+    if(cls == pool.class_count())
+        return ::operator delete(p);
+    pool.deallocate(p, cls);
+}
+
+#endif
@@ -0,0 +1,405 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_CORO_HPP
+#define CPPCON2018_CORO_HPP
+
+#if LOUNGE_COROUTINES
+
+#include "net.hpp"
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Allocate memory for a coroutine frame or an asynchronous
+// operation, reusing blocks recently freed on this thread.
+void* allocate_frame(std::size_t size);
+
+// Free memory from allocate_frame, given the same size
+void deallocate_frame(void* p, std::size_t size) noexcept;
+
+/** An allocator which uses the per-thread frame pool.
+
+    This is the allocator associated with the completion
+    handlers of use_task, so the operations awaited by a
+    coroutine come from the pool as well as its frames.
+*/
+template<class T>
+class frame_allocator
+{
+public:
+    using value_type = T;
+
+    frame_allocator() = default;
+
+    template<class U>
+    frame_allocator(frame_allocator<U> const&) noexcept
+    {
+    }
+
+    T*
+    allocate(std::size_t n)
+    {
+        return static_cast<T*>(allocate_frame(n * sizeof(T)));
+    }
+
+    void
+    deallocate(T* p, std::size_t n) noexcept
+    {
+        deallocate_frame(p, n * sizeof(T));
+    }
+
+    template<class U>
+    bool
+    operator==(frame_allocator<U> const&) const noexcept
+    {
+        return true;
+    }
+
+    template<class U>
+    bool
+    operator!=(frame_allocator<U> const&) const noexcept
+    {
+        return false;
+    }
+};
+
+namespace detail {
+
+struct task_promise_base
+{
+    // The coroutine to resume when this one finishes
+    std::coroutine_handle<> continuation;
+
+    // The spawned coroutine at the bottom of the await chain
+    std::coroutine_handle<> root;
+
+    std::exception_ptr error;
+
+    static
+    void*
+    operator new(std::size_t size)
+    {
+        return allocate_frame(size);
+    }
+
+    static
+    void
+    operator delete(void* p, std::size_t size) noexcept
+    {
+        deallocate_frame(p, size);
+    }
+
+    struct final_awaiter
+    {
+        bool
+        await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template<class Promise>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            if(auto c = h.promise().continuation)
+                return c;
+
+            // A spawned coroutine frees itself
+            h.destroy();
+            return std::noop_coroutine();
+        }
+
+        void
+        await_resume() const noexcept
+        {
+        }
+    };
+
+    std::suspend_always
+    initial_suspend() const noexcept
+    {
+        return {};
+    }
+
+    final_awaiter
+    final_suspend() const noexcept
+    {
+        return {};
+    }
+
+    void
+    unhandled_exception()
+    {
+        // Nothing waits for a spawned coroutine, so its exceptions
+        // leave io_context::run the same way a handler's would.
+        if(! continuation)
+            throw;
+        error = std::current_exception();
+    }
+};
+
+template<class T>
+struct task_promise : task_promise_base
+{
+    std::optional<T> value;
+
+    void
+    return_value(T v)
+    {
+        value.emplace(std::move(v));
+    }
+
+    T
+    get()
+    {
+        if(error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct task_promise<void> : task_promise_base
+{
+    void
+    return_void() const noexcept
+    {
+    }
+
+    void
+    get() const
+    {
+        if(error)
+            std::rethrow_exception(error);
+    }
+};
+
+} // detail
+
+/** A coroutine which starts when awaited, or when spawned.
+
+    Awaiting a task runs it to completion and produces its
+    result. Frames are allocated from the per-thread pool.
+*/
+template<class T = void>
+class task
+{
+public:
+    struct promise_type : detail::task_promise<T>
+    {
+        task
+        get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<
+                promise_type>::from_promise(*this));
+        }
+    };
+
+    task(task&& other) noexcept
+        : h_(std::exchange(other.h_, nullptr))
+    {
+    }
+
+    task& operator=(task&&) = delete;
+
+    ~task()
+    {
+        if(h_)
+            h_.destroy();
+    }
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    template<class Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> caller) noexcept
+    {
+        auto& p = h_.promise();
+        p.continuation = caller;
+        p.root = caller.promise().root;
+        return h_;
+    }
+
+    T
+    await_resume()
+    {
+        return h_.promise().get();
+    }
+
+private:
+    friend void spawn(task<void> t);
+
+    explicit
+    task(std::coroutine_handle<promise_type> h) noexcept
+        : h_(h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+/** Start a coroutine which runs on its own until it finishes.
+
+    The coroutine runs right away until it first suspends.
+    It should hold a reference to whatever object it uses.
+*/
+inline
+void
+spawn(task<void> t)
+{
+    auto h = std::exchange(t.h_, nullptr);
+    h.promise().root = h;
+    h.resume();
+}
+
+//------------------------------------------------------------------------------
+
+/** A completion token which makes an operation awaitable in a task.
+
+    The result is a tuple of the arguments to the completion
+    handler, so errors are returned rather than thrown:
+
+    @code
+    auto [ec, bytes] = co_await ws.async_read(buffer, use_task);
+    @endcode
+*/
+struct use_task_t
+{
+};
+
+constexpr use_task_t use_task{};
+
+namespace detail {
+
+template<class... Args>
+struct op_state
+{
+    std::coroutine_handle<> caller;
+    std::coroutine_handle<> root;
+    std::tuple<Args...> result;
+    bool pending = false;
+};
+
+template<class... Args>
+class op_handler
+{
+    op_state<Args...>* s_;
+
+public:
+    using allocator_type = frame_allocator<void>;
+
+    explicit
+    op_handler(op_state<Args...>& s) noexcept
+        : s_(&s)
+    {
+    }
+
+    op_handler(op_handler&& other) noexcept
+        : s_(std::exchange(other.s_, nullptr))
+    {
+    }
+
+    op_handler& operator=(op_handler&&) = delete;
+
+    ~op_handler()
+    {
+        // The operation was abandoned without completing, which
+        // happens when the io_context is destroyed with work
+        // pending. Free the coroutines which were waiting for it.
+        if(s_ && s_->pending)
+            s_->root.destroy();
+    }
+
+    allocator_type
+    get_allocator() const noexcept
+    {
+        return {};
+    }
+
+    void
+    operator()(Args... args)
+    {
+        auto const s = std::exchange(s_, nullptr);
+        s->pending = false;
+        s->result = std::tuple<Args...>(std::move(args)...);
+        s->caller.resume();
+    }
+};
+
+template<class Start, class... Args>
+struct op_awaiter
+{
+    Start& start;
+    op_state<Args...> state;
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    template<class Promise>
+    void
+    await_suspend(std::coroutine_handle<Promise> h)
+    {
+        state.caller = h;
+        state.root = h.promise().root;
+        start(op_handler<Args...>(state));
+        state.pending = true;
+    }
+
+    std::tuple<Args...>
+    await_resume()
+    {
+        return std::move(state.result);
+    }
+};
+
+} // detail
+
+namespace boost {
+namespace asio {
+
+template<class R, class... Args>
+class async_result<use_task_t, R(Args...)>
+{
+public:
+    using return_type = task<std::tuple<typename std::decay<Args>::type...>>;
+
+    // The operation is started when the returned task is awaited
+    template<class Initiation, class... InitArgs>
+    static
+    return_type
+    initiate(Initiation initiation, use_task_t, InitArgs... args)
+    {
+        auto start =
+            [&](auto handler)
+            {
+                std::move(initiation)(std::move(handler), std::move(args)...);
+            };
+        co_return co_await ::detail::op_awaiter<
+            decltype(start), typename std::decay<Args>::type...>{start, {}};
+    }
+};
+
+} // asio
+} // boost
+
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_FILE_RANGE_BODY_HPP
+#define CPPCON2018_FILE_RANGE_BODY_HPP
+
+#include "net.hpp"
+#include "beast.hpp"
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** A message body made of byte ranges of an open file.
+
+    The body is a sequence of parts. Each part is either
+    literal text, such as the boundary and headers of a
+    multipart/byteranges response, or a slice of the file.
+    File slices are read directly from the file when the
+    message is serialized, so nothing is buffered up front.
+*/
+struct file_range_body
+{
+    class value_type
+    {
+        friend struct file_range_body;
+
+        struct part
+        {
+            std::string text;
+            std::uint64_t offset = 0;
+            std::uint64_t length = 0;
+        };
+
+        beast::file file_;
+        std::vector<part> parts_;
+        std::uint64_t size_ = 0;
+
+    public:
+        value_type() = default;
+        value_type(value_type&&) = default;
+        value_type& operator=(value_type&&) = default;
+
+        // Take ownership of an open file
+        explicit
+        value_type(beast::file&& file)
+            : file_(std::move(file))
+        {
+        }
+
+        // Append literal text to the body
+        void
+        append_text(std::string text)
+        {
+            part p;
+            size_ += text.size();
+            p.text = std::move(text);
+            parts_.push_back(std::move(p));
+        }
+
+        // Append `length` bytes of the file starting at `offset`
+        void
+        append_range(std::uint64_t offset, std::uint64_t length)
+        {
+            part p;
+            p.offset = offset;
+            p.length = length;
+            size_ += length;
+            parts_.push_back(std::move(p));
+        }
+
+        std::uint64_t
+        size() const noexcept
+        {
+            return size_;
+        }
+    };
+
+    static
+    std::uint64_t
+    size(value_type const& body) noexcept
+    {
+        return body.size();
+    }
+
+    // Algorithm for retrieving buffers when serializing
+    class writer
+    {
+        value_type& body_;
+        std::size_t index_ = 0;     // The current part
+        std::uint64_t remain_ = 0;  // Unread bytes of the current file slice
+        bool started_ = false;      // Whether the current slice was seeked
+        char buf_[4096];
+
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(http::header<isRequest, Fields>&, value_type& body)
+            : body_(body)
+        {
+        }
+
+        void
+        init(error_code& ec)
+        {
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(error_code& ec)
+        {
+            ec = {};
+            while(index_ < body_.parts_.size())
+            {
+                auto const& p = body_.parts_[index_];
+
+                // Literal text is returned in one piece
+                if(p.length == 0)
+                {
+                    ++index_;
+                    if(p.text.empty())
+                        continue;
+                    return {{
+                        net::buffer(p.text),
+                        index_ < body_.parts_.size()}};
+                }
+
+                // Position the file at the start of the slice
+                if(! started_)
+                {
+                    body_.file_.seek(p.offset, ec);
+                    if(ec)
+                        return boost::none;
+                    remain_ = p.length;
+                    started_ = true;
+                }
+
+                auto const amount = remain_ > sizeof(buf_) ?
+                    sizeof(buf_) : static_cast<std::size_t>(remain_);
+                auto const nread = body_.file_.read(buf_, amount, ec);
+                if(ec)
+                    return boost::none;
+                if(nread == 0)
+                {
+                    ec = http::error::short_read;
+                    return boost::none;
+                }
+                remain_ -= nread;
+                if(remain_ == 0)
+                {
+                    ++index_;
+                    started_ = false;
+                }
+                return {{
+                    const_buffers_type{buf_, nread},
+                    index_ < body_.parts_.size()}};
+            }
+            return boost::none;
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,362 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "handoff.hpp"
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#include "listener.hpp"
+#include "shared_state.hpp"
+#include "websocket_session.hpp"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// Time allowed for the last closing handshakes to finish
+static std::chrono::seconds constexpr linger{2};
+
+// Time allowed for the new process to start accepting
+static std::chrono::seconds constexpr ack_timeout{10};
+
+// Sent by the new process once its listener is running
+static char constexpr ack_byte = 'A';
+
+// Don't raise SIGPIPE when the peer has gone away
+#ifdef MSG_NOSIGNAL
+static int constexpr send_flags = MSG_NOSIGNAL;
+#else
+static int constexpr send_flags = 0;
+#endif
+
+// Returns `true` if the peer of a Unix socket runs as our user
+static
+bool
+same_user(int fd)
+{
+#ifdef SO_PEERCRED
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    if(::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+        return false;
+    return cred.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if(::getpeereid(fd, &uid, &gid) != 0)
+        return false;
+    return uid == ::geteuid();
+#endif
+}
+
+handoff::
+handoff(
+    net::io_context& ioc,
+    std::string const& path,
+    std::shared_ptr<listener> const& l,
+    std::shared_ptr<shared_state> const& state,
+    std::chrono::steady_clock::duration drain)
+    : ioc_(ioc)
+    , acceptor_(ioc)
+    , socket_(ioc)
+    , listener_(l)
+    , state_(state)
+    , drain_(drain)
+    , interval_(0)
+    , timer_(ioc)
+{
+    error_code ec;
+
+    // Remove the socket file left by a previous process
+    ::unlink(path.c_str());
+
+    net::local::stream_protocol::endpoint endpoint(path);
+
+    acceptor_.open(endpoint.protocol(), ec);
+    if(ec)
+    {
+        fail(ec, "handoff open");
+        return;
+    }
+
+    acceptor_.bind(endpoint, ec);
+    if(ec)
+    {
+        fail(ec, "handoff bind");
+        return;
+    }
+
+    // Only our own user may connect
+    if(::chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0)
+    {
+        fail(error_code(errno, boost::system::system_category()), "handoff chmod");
+        acceptor_.close(ec);
+        return;
+    }
+
+    acceptor_.listen(1, ec);
+    if(ec)
+    {
+        fail(ec, "handoff listen");
+        return;
+    }
+}
+
+void
+handoff::
+run()
+{
+    if(! acceptor_.is_open())
+        return;
+
+    acceptor_.async_accept(
+        socket_,
+        [self = shared_from_this()](error_code ec)
+        {
+            self->on_accept(ec);
+        });
+}
+
+// Report a failure
+void
+handoff::
+fail(error_code ec, char const* what)
+{
+    // Don't report on canceled operations
+    if(ec == net::error::operation_aborted)
+        return;
+    std::cerr << what << ": " << ec.message() << "\n";
+}
+
+// A new process connected, give it the listening socket
+void
+handoff::
+on_accept(error_code ec)
+{
+    if(ec)
+        return fail(ec, "handoff accept");
+
+    // Only a process of our own user may take over
+    if(! same_user(socket_.native_handle()))
+    {
+        std::cerr << "handoff: refused a process of another user\n";
+        socket_.close(ec);
+        return run();
+    }
+
+    // Pass the descriptor as ancillary data
+    int const fd = listener_->native_handle();
+    char byte = 'L';
+    iovec iov{&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if(::sendmsg(socket_.native_handle(), &msg, send_flags) != 1)
+    {
+        fail(error_code(errno, boost::system::system_category()), "handoff send");
+        socket_.close(ec);
+
+        // Keep serving and wait for another attempt
+        return run();
+    }
+
+    // Keep accepting until the new process is accepting too
+    net::async_read(
+        socket_,
+        net::buffer(&ack_, 1),
+        [self = shared_from_this()](error_code ec, std::size_t)
+        {
+            self->on_ack(ec);
+        });
+    timer_.expires_after(ack_timeout);
+    timer_.async_wait(
+        [self = shared_from_this()](error_code ec)
+        {
+            if(ec)
+                return;
+            self->fail(net::error::timed_out, "handoff ack");
+            self->socket_.cancel(ec);
+        });
+}
+
+// The new process answered, or gave up
+void
+handoff::
+on_ack(error_code ec)
+{
+    timer_.cancel();
+
+    if(! ec && ack_ != ack_byte)
+        ec = net::error::invalid_argument;
+    if(ec)
+    {
+        // A process which exits early leaves us at end of file
+        fail(ec, "handoff ack");
+        socket_.close(ec);
+
+        // Keep serving and wait for another attempt
+        return run();
+    }
+
+    // The new process owns the path and the listening socket now
+    socket_.close(ec);
+    acceptor_.close(ec);
+    listener_->stop();
+
+    // Close the sessions one at a time across the drain period
+    sessions_ = state_->sessions();
+    if(! sessions_.empty())
+        interval_ = drain_ / sessions_.size();
+    std::cerr << "handoff: draining " << sessions_.size() << " sessions\n";
+    on_timer({});
+}
+
+void
+handoff::
+on_timer(error_code ec)
+{
+    if(ec)
+        return fail(ec, "handoff timer");
+
+    if(! sessions_.empty())
+    {
+        if(auto sp = sessions_.back().lock())
+            sp->close(websocket::close_code::service_restart);
+        sessions_.pop_back();
+    }
+
+    if(sessions_.empty())
+    {
+        // Give the closing handshakes a moment, then exit
+        timer_.expires_after(linger);
+        timer_.async_wait(
+            [self = shared_from_this()](error_code)
+            {
+                self->ioc_.stop();
+            });
+        return;
+    }
+
+    timer_.expires_after(interval_);
+    timer_.async_wait(
+        [self = shared_from_this()](error_code ec)
+        {
+            self->on_timer(ec);
+        });
+}
+
+int
+handoff::
+receive(
+    std::string const& path,
+    net::local::stream_protocol::socket& sock,
+    error_code& ec)
+{
+    // The socket stays open only if a descriptor is returned
+    error_code ignored;
+    sock.connect(net::local::stream_protocol::endpoint(path), ec);
+    if(ec)
+    {
+        sock.close(ignored);
+        return -1;
+    }
+
+    // Only adopt a socket from a process of our own user
+    if(! same_user(sock.native_handle()))
+    {
+        ec = net::error::access_denied;
+        sock.close(ignored);
+        return -1;
+    }
+
+    // Don't wait forever on a process which does not answer
+    timeval tv{5, 0};
+    ::setsockopt(sock.native_handle(),
+        SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char byte;
+    iovec iov{&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(::recvmsg(sock.native_handle(), &msg, 0) != 1)
+    {
+        ec = error_code(errno, boost::system::system_category());
+        sock.close(ignored);
+        return -1;
+    }
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if( ! cmsg ||
+        cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+    {
+        ec = net::error::invalid_argument;
+        sock.close(ignored);
+        return -1;
+    }
+
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    // Refuse a message whose ancillary data did not fit
+    if(msg.msg_flags & MSG_CTRUNC)
+    {
+        ::close(fd);
+        ec = net::error::invalid_argument;
+        sock.close(ignored);
+        return -1;
+    }
+
+    // Don't pass the listening socket on to child processes
+    if(::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+    {
+        ec = error_code(errno, boost::system::system_category());
+        ::close(fd);
+        sock.close(ignored);
+        return -1;
+    }
+
+    ec = {};
+    return fd;
+}
+
+void
+handoff::
+acknowledge(
+    net::local::stream_protocol::socket& sock,
+    error_code& ec)
+{
+    // The write does not raise SIGPIPE if the process went away
+    char const byte = ack_byte;
+    net::write(sock, net::buffer(&byte, 1), ec);
+    error_code ignored;
+    sock.close(ignored);
+}
+
+#endif
@@ -0,0 +1,99 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_HANDOFF_HPP
+#define CPPCON2018_HANDOFF_HPP
+
+#include "net.hpp"
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Forward declarations
+class listener;
+class shared_state;
+class websocket_session;
+
+/** Hands the listening socket to a new process during an upgrade.
+
+    A running server listens on a Unix domain socket which only
+    its own user may use. When a new server process of the same
+    user connects, the listening socket is passed to it. Once the
+    new process acknowledges that it is accepting, this process
+    stops. Connections waiting in the kernel backlog are accepted
+    by the new process, so none are refused.
+
+    The open WebSocket sessions of this process are then closed
+    with the "service restart" code, spread evenly over the drain
+    period, so clients reconnect to the new process gradually
+    instead of all at once. Afterwards the io_context is stopped.
+
+    Since this process keeps recording while it drains, a new
+    process which was asked to capture traffic writes to the
+    capture path with its process id appended.
+*/
+class handoff : public std::enable_shared_from_this<handoff>
+{
+    net::io_context& ioc_;
+    net::local::stream_protocol::acceptor acceptor_;
+    net::local::stream_protocol::socket socket_;
+    std::shared_ptr<listener> listener_;
+    std::shared_ptr<shared_state> state_;
+    std::chrono::steady_clock::duration drain_;
+    std::chrono::steady_clock::duration interval_;
+    net::steady_timer timer_;
+    std::vector<std::weak_ptr<websocket_session>> sessions_;
+    char ack_ = 0;
+
+    void fail(error_code ec, char const* what);
+    void on_accept(error_code ec);
+    void on_ack(error_code ec);
+    void on_timer(error_code ec);
+
+public:
+    handoff(
+        net::io_context& ioc,
+        std::string const& path,
+        std::shared_ptr<listener> const& l,
+        std::shared_ptr<shared_state> const& state,
+        std::chrono::steady_clock::duration drain);
+
+    // Wait for a new process to take over
+    void run();
+
+    /** Take over the listening socket of a running process.
+
+        Returns the native handle of the listening socket, or -1
+        with `ec` set if no process of our own user is waiting at
+        `path`. The
+        running process keeps accepting until `acknowledge` is
+        called on `sock`.
+    */
+    static
+    int
+    receive(
+        std::string const& path,
+        net::local::stream_protocol::socket& sock,
+        error_code& ec);
+
+    // Tell the running process that the new listener is accepting
+    static
+    void
+    acknowledge(
+        net::local::stream_protocol::socket& sock,
+        error_code& ec);
+};
+
+#endif
+
+#endif
@@ -8,47 +8,22 @@
 //
 
 #include "http_session.hpp"
+#include "file_range_body.hpp"
+#include "mime_types.hpp"
+#include "response_fields.hpp"
 #include "websocket_session.hpp"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 //------------------------------------------------------------------------------
 
-// Return a reasonable mime type based on the extension of a file.
-boost::beast::string_view
-mime_type(boost::beast::string_view path)
-{
-    using boost::beast::iequals;
-    auto const ext = [&path]
-    {
-        auto const pos = path.rfind(".");
-        if(pos == boost::beast::string_view::npos)
-            return boost::beast::string_view{};
-        return path.substr(pos);
-    }();
-    if(iequals(ext, ".htm"))  return "text/html";
-    if(iequals(ext, ".html")) return "text/html";
-    if(iequals(ext, ".php"))  return "text/html";
-    if(iequals(ext, ".css"))  return "text/css";
-    if(iequals(ext, ".txt"))  return "text/plain";
-    if(iequals(ext, ".js"))   return "application/javascript";
-    if(iequals(ext, ".json")) return "application/json";
-    if(iequals(ext, ".xml"))  return "application/xml";
-    if(iequals(ext, ".swf"))  return "application/x-shockwave-flash";
-    if(iequals(ext, ".flv"))  return "video/x-flv";
-    if(iequals(ext, ".png"))  return "image/png";
-    if(iequals(ext, ".jpe"))  return "image/jpeg";
-    if(iequals(ext, ".jpeg")) return "image/jpeg";
-    if(iequals(ext, ".jpg"))  return "image/jpeg";
-    if(iequals(ext, ".gif"))  return "image/gif";
-    if(iequals(ext, ".bmp"))  return "image/bmp";
-    if(iequals(ext, ".ico"))  return "image/vnd.microsoft.icon";
-    if(iequals(ext, ".tiff")) return "image/tiff";
-    if(iequals(ext, ".tif"))  return "image/tiff";
-    if(iequals(ext, ".svg"))  return "image/svg+xml";
-    if(iequals(ext, ".svgz")) return "image/svg+xml";
-    return "application/text";
-}
-
 // Append an HTTP rel-path to a local filesystem path.
 // The returned path is normalized for the platform.
 std::string
@@ -76,14 +51,193 @@ path_cat(
     return result;
 }
 
+// Format a time as an HTTP-date (IMF-fixdate)
+std::string
+http_date(std::time_t t)
+{
+    std::tm tm;
+#if BOOST_MSVC
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char buf[64];
+    auto const n = std::strftime(
+        buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+// Parse an unsigned decimal number, rejecting
+// empty strings, stray characters, and overflow.
+bool
+parse_uint(boost::beast::string_view s, std::uint64_t& v)
+{
+    if(s.empty())
+        return false;
+    v = 0;
+    for(auto c : s)
+    {
+        if(c < '0' || c > '9')
+            return false;
+        auto const d = static_cast<std::uint64_t>(c - '0');
+        if(v > (UINT64_MAX - d) / 10)
+            return false;
+        v = v * 10 + d;
+    }
+    return true;
+}
+
+// Parse an HTTP-date in the IMF-fixdate format,
+// e.g. "Sun, 06 Nov 1994 08:49:37 GMT". The obsolete
+// formats are not accepted and the header is then ignored.
+bool
+parse_http_date(boost::beast::string_view s, std::time_t& t)
+{
+    static char const* const months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+    if(s.size() != 29 || s[3] != ',' || s.substr(25) != " GMT")
+        return false;
+    std::uint64_t day, year, hh, mm, ss;
+    if( ! parse_uint(s.substr(5, 2), day) ||
+        ! parse_uint(s.substr(12, 4), year) ||
+        ! parse_uint(s.substr(17, 2), hh) ||
+        ! parse_uint(s.substr(20, 2), mm) ||
+        ! parse_uint(s.substr(23, 2), ss))
+        return false;
+    int month = 0;
+    while(month < 12 && s.substr(8, 3) != months[month])
+        ++month;
+    if(month == 12 || day < 1 || day > 31 || hh > 23 || mm > 59 || ss > 60)
+        return false;
+
+    // Days since the epoch for a civil date (proleptic Gregorian)
+    std::int64_t const m = month + 1;
+    std::int64_t const y = static_cast<std::int64_t>(year) - (m <= 2);
+    std::int64_t const era = (y >= 0 ? y : y - 399) / 400;
+    std::int64_t const yoe = y - era * 400;
+    std::int64_t const doy =
+        (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 +
+        static_cast<std::int64_t>(day) - 1;
+    std::int64_t const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    std::int64_t const days = era * 146097 + doe - 719468;
+
+    t = static_cast<std::time_t>(
+        days * 86400 + static_cast<std::int64_t>(hh * 3600 + mm * 60 + ss));
+    return true;
+}
+
+// Returns `true` if the If-None-Match list contains
+// the entity tag, using the weak comparison function.
+bool
+etag_matches(
+    boost::beast::string_view list,
+    boost::beast::string_view etag)
+{
+    auto const trim =
+        [](boost::beast::string_view s)
+        {
+            while(! s.empty() && (s.front() == ' ' || s.front() == '\t'))
+                s.remove_prefix(1);
+            while(! s.empty() && (s.back() == ' ' || s.back() == '\t'))
+                s.remove_suffix(1);
+            if(s.starts_with("W/"))
+                s.remove_prefix(2);
+            return s;
+        };
+
+    etag = trim(etag);
+    for(;;)
+    {
+        auto const pos = list.find(',');
+        auto const tag = trim(list.substr(0, pos));
+        if(tag == "*" || tag == etag)
+            return true;
+        if(pos == boost::beast::string_view::npos)
+            return false;
+        list.remove_prefix(pos + 1);
+    }
+}
+
+// The most ranges we will serve in one response. Requests
+// for more are answered with the whole file, which prevents
+// clients from making us send many tiny overlapping parts.
+std::size_t constexpr max_ranges = 16;
+
+// Parse a Range header such as "bytes=0-99,200-,-50".
+// Returns `false` if the header is malformed or otherwise
+// must be ignored. On success `ranges` holds the satisfiable
+// ranges as inclusive {first, last} pairs, and is empty if
+// none of them could be satisfied.
+bool
+parse_range(
+    boost::beast::string_view s,
+    std::uint64_t size,
+    std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges)
+{
+    if(s.size() < 6 || ! boost::beast::iequals(s.substr(0, 6), "bytes="))
+        return false;
+    s.remove_prefix(6);
+
+    bool any = false;
+    for(;;)
+    {
+        auto const pos = s.find(',');
+        auto spec = s.substr(0, pos);
+        while(! spec.empty() && (spec.front() == ' ' || spec.front() == '\t'))
+            spec.remove_prefix(1);
+        while(! spec.empty() && (spec.back() == ' ' || spec.back() == '\t'))
+            spec.remove_suffix(1);
+
+        if(! spec.empty())
+        {
+            auto const dash = spec.find('-');
+            if(dash == boost::beast::string_view::npos)
+                return false;
+            auto const first_s = spec.substr(0, dash);
+            auto const last_s = spec.substr(dash + 1);
+            std::uint64_t first;
+            std::uint64_t last;
+            if(first_s.empty())
+            {
+                // suffix-byte-range-spec: the final N bytes
+                std::uint64_t n;
+                if(! parse_uint(last_s, n))
+                    return false;
+                if(n > 0 && size > 0)
+                    ranges.emplace_back(n < size ? size - n : 0, size - 1);
+            }
+            else
+            {
+                if(! parse_uint(first_s, first))
+                    return false;
+                if(last_s.empty())
+                    last = UINT64_MAX;
+                else if(! parse_uint(last_s, last) || last < first)
+                    return false;
+                if(first < size)
+                    ranges.emplace_back(first, std::min(last, size - 1));
+            }
+            any = true;
+        }
+
+        if(pos == boost::beast::string_view::npos)
+            break;
+        s.remove_prefix(pos + 1);
+    }
+    return any && ranges.size() <= max_ranges;
+}
+
 // This function produces an HTTP response for the given
 // request. The type of the response object depends on the
 // contents of the request, so the interface requires the
 // caller to pass a generic lambda for receiving the response.
+// Whatever the lambda returns is returned.
 template<
     class Body, class Allocator,
     class Send>
-void
+auto
 handle_request(
     boost::beast::string_view doc_root,
     http::request<Body, http::basic_fields<Allocator>>&& req,
@@ -93,9 +247,8 @@ handle_request(
     auto const bad_request =
     [&req](boost::beast::string_view why)
     {
-        http::response<http::string_body> res{http::status::bad_request, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/html");
+        http::response<http::string_body, response_fields> res{http::status::bad_request, req.version()};
+        res.content_type(mime_html);
         res.keep_alive(req.keep_alive());
         res.body() = why.to_string();
         res.prepare_payload();
@@ -106,9 +259,8 @@ handle_request(
     auto const not_found =
     [&req](boost::beast::string_view target)
     {
-        http::response<http::string_body> res{http::status::not_found, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/html");
+        http::response<http::string_body, response_fields> res{http::status::not_found, req.version()};
+        res.content_type(mime_html);
         res.keep_alive(req.keep_alive());
         res.body() = "The resource '" + target.to_string() + "' was not found.";
         res.prepare_payload();
@@ -119,9 +271,8 @@ handle_request(
     auto const server_error =
     [&req](boost::beast::string_view what)
     {
-        http::response<http::string_body> res{http::status::internal_server_error, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/html");
+        http::response<http::string_body, response_fields> res{http::status::internal_server_error, req.version()};
+        res.content_type(mime_html);
         res.keep_alive(req.keep_alive());
         res.body() = "An error occurred: '" + what.to_string() + "'";
         res.prepare_payload();
@@ -160,29 +311,183 @@ handle_request(
     // Cache the size since we need it after the move
     auto const size = body.size();
 
+    // Build the validators from the size and modification time
+    // of the file we opened, so they describe the bytes we send.
+    struct stat st;
+#if BOOST_MSVC
+    if(::stat(path.c_str(), &st) != 0)
+#else
+    if(::fstat(body.file().native_handle(), &st) != 0)
+#endif
+        return send(server_error("stat failed"));
+    auto const mtime = static_cast<std::time_t>(st.st_mtime);
+
+    // The tag includes the fraction of a second where we have it,
+    // so two writes of the same size within a second differ.
+#if BOOST_MSVC
+    long const mtime_ns = 0;
+#elif defined(__APPLE__)
+    long const mtime_ns = st.st_mtimespec.tv_nsec;
+#else
+    long const mtime_ns = st.st_mtim.tv_nsec;
+#endif
+    std::string etag;
+    {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "\"%llx-%llx.%lx\"",
+            static_cast<unsigned long long>(size),
+            static_cast<unsigned long long>(mtime),
+            static_cast<unsigned long>(mtime_ns));
+        etag = buf;
+    }
+    auto const last_modified = http_date(mtime);
+
+    auto const type = mime_index(path);
+
+    // Sets the fields common to every response for the file
+    auto const set_fields =
+    [&](auto& res)
+    {
+        res.set(http::field::etag, etag);
+        res.set(http::field::last_modified, last_modified);
+        res.set(http::field::accept_ranges, "bytes");
+        res.keep_alive(req.keep_alive());
+    };
+
+    // Respond to a conditional request whose cached copy is still fresh.
+    // If-Modified-Since is only considered when If-None-Match is absent.
+    {
+        bool fresh = false;
+        auto const inm = req[http::field::if_none_match];
+        if(! inm.empty())
+        {
+            fresh = etag_matches(inm, etag);
+        }
+        else
+        {
+            // A date in the future is invalid and ignored (RFC 7232)
+            std::time_t since;
+            auto const ims = req[http::field::if_modified_since];
+            fresh = ! ims.empty() &&
+                parse_http_date(ims, since) &&
+                since <= std::time(nullptr) && mtime <= since;
+        }
+        if(fresh)
+        {
+            http::response<http::empty_body, response_fields> res{http::status::not_modified, req.version()};
+            set_fields(res);
+            return send(std::move(res));
+        }
+    }
+
     // Respond to HEAD request
     if(req.method() == http::verb::head)
     {
-        http::response<http::empty_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, mime_type(path));
+        http::response<http::empty_body, response_fields> res{http::status::ok, req.version()};
+        set_fields(res);
+        res.content_type(type);
         res.content_length(size);
-        res.keep_alive(req.keep_alive());
+        return send(std::move(res));
+    }
+
+    // Honor a Range header, unless If-Range names another version
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+    auto const range = req[http::field::range];
+    auto const if_range = req[http::field::if_range];
+    if( ! range.empty() &&
+        (if_range.empty() || if_range == etag || if_range == last_modified) &&
+        parse_range(range, size, ranges))
+    {
+        // None of the ranges overlap the file
+        if(ranges.empty())
+        {
+            http::response<http::string_body, response_fields> res{
+                http::status::range_not_satisfiable, req.version()};
+            set_fields(res);
+            res.content_type(mime_html);
+            res.set(http::field::content_range,
+                "bytes */" + std::to_string(size));
+            res.body() = "The requested range is not satisfiable.";
+            res.prepare_payload();
+            return send(std::move(res));
+        }
+
+        auto const content_range =
+            [size](std::pair<std::uint64_t, std::uint64_t> const& r)
+            {
+                return "bytes " + std::to_string(r.first) + "-" +
+                    std::to_string(r.second) + "/" + std::to_string(size);
+            };
+
+        file_range_body::value_type rb{std::move(body.file())};
+        std::string multipart_type;
+        std::string single_range;
+        if(ranges.size() == 1)
+        {
+            // A single range is sent as the body itself
+            rb.append_range(ranges[0].first,
+                ranges[0].second - ranges[0].first + 1);
+            single_range = content_range(ranges[0]);
+        }
+        else
+        {
+            // Several ranges are sent as multipart/byteranges
+            auto const boundary = "lounge-" + etag.substr(1, etag.size() - 2);
+            for(auto const& r : ranges)
+            {
+                rb.append_text(
+                    "\r\n--" + boundary + "\r\n"
+                    "Content-Type: " + std::string(mime_types[type]) + "\r\n"
+                    "Content-Range: " + content_range(r) + "\r\n\r\n");
+                rb.append_range(r.first, r.second - r.first + 1);
+            }
+            rb.append_text("\r\n--" + boundary + "--\r\n");
+            multipart_type = "multipart/byteranges; boundary=" + boundary;
+        }
+
+        auto const rb_size = rb.size();
+        http::response<file_range_body, response_fields> res{
+            std::piecewise_construct,
+            std::make_tuple(std::move(rb)),
+            std::make_tuple(http::status::partial_content, req.version())};
+        set_fields(res);
+        if(multipart_type.empty())
+            res.content_type(type);
+        else
+            res.set(http::field::content_type, multipart_type);
+        if(! single_range.empty())
+            res.set(http::field::content_range, single_range);
+        res.content_length(rb_size);
         return send(std::move(res));
     }
 
     // Respond to GET request
-    http::response<http::file_body> res{
+    http::response<http::file_body, response_fields> res{
         std::piecewise_construct,
         std::make_tuple(std::move(body)),
         std::make_tuple(http::status::ok, req.version())};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, mime_type(path));
+    set_fields(res);
+    res.content_type(type);
     res.content_length(size);
-    res.keep_alive(req.keep_alive());
     return send(std::move(res));
 }
 
+// Returns a response refusing a WebSocket upgrade
+// while the server is too busy to take on a session.
+template<class Body, class Allocator>
+http::response<http::string_body, response_fields>
+service_unavailable(
+    http::request<Body, http::basic_fields<Allocator>> const& req)
+{
+    http::response<http::string_body, response_fields> res{http::status::service_unavailable, req.version()};
+    res.content_type(mime_html);
+    res.set(http::field::retry_after, "1");
+    res.keep_alive(false);
+    res.body() = "The server is busy, try again later.";
+    res.prepare_payload();
+    return res;
+}
+
 //------------------------------------------------------------------------------
 
 http_session::
@@ -192,12 +497,22 @@ http_session(
     : socket_(std::move(socket))
     , state_(state)
 {
+    state_->add_connection();
+}
+
+http_session::
+~http_session()
+{
+    state_->remove_connection();
 }
 
 void
 http_session::
 run()
 {
+#if LOUNGE_COROUTINES
+    spawn(loop());
+#else
     // Read a request
     http::async_read(socket_, buffer_, req_,
         [self = shared_from_this()]
@@ -205,6 +520,7 @@ run()
         {
             self->on_read(ec, bytes);
         });
+#endif
 }
 
 // Report a failure
@@ -219,6 +535,95 @@ fail(error_code ec, char const* what)
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
+#if LOUNGE_COROUTINES
+
+task<>
+http_session::
+loop()
+{
+    auto self = shared_from_this();
+
+    for(;;)
+    {
+        // Read a request
+        auto [ec, bytes] = co_await http::async_read(
+            socket_, buffer_, req_, use_task);
+
+        // This means they closed the connection
+        if(ec == http::error::end_of_stream)
+        {
+            socket_.shutdown(tcp::socket::shutdown_send, ec);
+            co_return;
+        }
+
+        // Handle the error, if any
+        if(ec)
+        {
+            fail(ec, "read");
+            co_return;
+        }
+
+        // See if it is a WebSocket Upgrade
+        if(websocket::is_upgrade(req_))
+        {
+            // Turn it away if we are too busy for another session
+            if(! state_->admit_upgrade())
+            {
+                co_await write(service_unavailable(req_));
+                co_return;
+            }
+
+            // Create a WebSocket session by transferring the socket
+            std::make_shared<websocket_session>(
+                std::move(socket_), state_)->run(std::move(req_));
+            co_return;
+        }
+
+        // Send the response. The task which writes it holds
+        // the response in its frame until the write finishes.
+        auto const keep_reading = co_await handle_request(
+            state_->doc_root(), std::move(req_),
+            [this](auto&& response)
+            {
+                return write(std::move(response));
+            });
+        if(! keep_reading)
+            co_return;
+
+        // Clear contents of the request message,
+        // otherwise the read behavior is undefined.
+        req_ = {};
+    }
+}
+
+// Write a response, returning `true` to read another request
+template<class Response>
+task<bool>
+http_session::
+write(Response res)
+{
+    auto [ec, bytes] = co_await http::async_write(socket_, res, use_task);
+
+    // Handle the error, if any
+    if(ec)
+    {
+        fail(ec, "write");
+        co_return false;
+    }
+
+    if(res.need_eof())
+    {
+        // This means we should close the connection, usually because
+        // the response indicated the "Connection: close" semantic.
+        socket_.shutdown(tcp::socket::shutdown_send, ec);
+        co_return false;
+    }
+
+    co_return true;
+}
+
+#else
+
 void
 http_session::
 on_read(error_code ec, std::size_t)
@@ -234,17 +639,8 @@ on_read(error_code ec, std::size_t)
     if(ec)
         return fail(ec, "read");
 
-    // See if it is a WebSocket Upgrade
-    if(websocket::is_upgrade(req_))
-    {
-        // Create a WebSocket session by transferring the socket
-        std::make_shared<websocket_session>(
-            std::move(socket_), state_)->run(std::move(req_));
-        return;
-    }
-
-    // Send the response
-    handle_request(state_->doc_root(), std::move(req_),
+    // Writes a response
+    auto const send =
         [this](auto&& response)
         {
             // The lifetime of the message has to extend
@@ -272,7 +668,23 @@ on_read(error_code ec, std::size_t)
 					self->on_write(ec, bytes, sp->need_eof()); 
 				});
 #endif
-        });
+        };
+
+    // See if it is a WebSocket Upgrade
+    if(websocket::is_upgrade(req_))
+    {
+        // Turn it away if we are too busy for another session
+        if(! state_->admit_upgrade())
+            return send(service_unavailable(req_));
+
+        // Create a WebSocket session by transferring the socket
+        std::make_shared<websocket_session>(
+            std::move(socket_), state_)->run(std::move(req_));
+        return;
+    }
+
+    // Send the response
+    handle_request(state_->doc_root(), std::move(req_), send);
 }
 
 void
@@ -303,3 +715,5 @@ on_write(error_code ec, std::size_t, bool close)
             self->on_read(ec, bytes);
         });
 }
+
+#endif
@@ -12,6 +12,7 @@
 
 #include "net.hpp"
 #include "beast.hpp"
+#include "coro.hpp"
 #include "shared_state.hpp"
 #include <cstdlib>
 #include <memory>
@@ -26,15 +27,23 @@ class http_session : public std::enable_shared_from_this<http_session>
     http::request<http::string_body> req_;
 
     void fail(error_code ec, char const* what);
+#if LOUNGE_COROUTINES
+    task<> loop();
+    template<class Response>
+    task<bool> write(Response res);
+#else
     void on_read(error_code ec, std::size_t);
     void on_write(
         error_code ec, std::size_t, bool close);
+#endif
 
 public:
     http_session(
         tcp::socket socket,
         std::shared_ptr<shared_state> const& state);
 
+    ~http_session();
+
     void run();
 };
 
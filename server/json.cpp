@@ -0,0 +1,257 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "json.hpp"
+#include <cstring>
+
+namespace {
+
+// A recursive descent checker for the grammar of RFC 8259
+class validator
+{
+    char const* p_;
+    char const* end_;
+    unsigned depth_ = 0;
+
+    // Deep enough for any JSON-RPC message, shallow enough for the stack
+    static unsigned constexpr max_depth = 64;
+
+    bool
+    more() const noexcept
+    {
+        return p_ < end_;
+    }
+
+    static
+    bool
+    is_digit(char c) noexcept
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static
+    bool
+    is_hex(char c) noexcept
+    {
+        return is_digit(c) ||
+            (c >= 'a' && c <= 'f') ||
+            (c >= 'A' && c <= 'F');
+    }
+
+    void
+    skip_space() noexcept
+    {
+        while(more() && (*p_ == ' ' ||
+            *p_ == '\t' || *p_ == '\r' || *p_ == '\n'))
+            ++p_;
+    }
+
+    bool
+    literal(char const* s) noexcept
+    {
+        auto const n = std::strlen(s);
+        if(static_cast<std::size_t>(end_ - p_) < n ||
+            std::memcmp(p_, s, n) != 0)
+            return false;
+        p_ += n;
+        return true;
+    }
+
+    bool
+    string() noexcept
+    {
+        ++p_; // opening quote
+        while(more())
+        {
+            auto const c = static_cast<unsigned char>(*p_++);
+            if(c == '"')
+                return true;
+            if(c < 0x20)
+                return false;
+            if(c != '\\')
+                continue;
+            if(! more())
+                return false;
+            switch(*p_++)
+            {
+            case '"': case '\\': case '/': case 'b':
+            case 'f': case 'n': case 'r': case 't':
+                break;
+            case 'u':
+                for(int i = 0; i < 4; ++i)
+                    if(! more() || ! is_hex(*p_++))
+                        return false;
+                break;
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool
+    number() noexcept
+    {
+        if(*p_ == '-')
+            ++p_;
+        if(! more())
+            return false;
+        if(*p_ == '0')
+        {
+            ++p_;
+        }
+        else if(is_digit(*p_))
+        {
+            while(more() && is_digit(*p_))
+                ++p_;
+        }
+        else
+        {
+            return false;
+        }
+        if(more() && *p_ == '.')
+        {
+            ++p_;
+            if(! more() || ! is_digit(*p_))
+                return false;
+            while(more() && is_digit(*p_))
+                ++p_;
+        }
+        if(more() && (*p_ == 'e' || *p_ == 'E'))
+        {
+            ++p_;
+            if(more() && (*p_ == '+' || *p_ == '-'))
+                ++p_;
+            if(! more() || ! is_digit(*p_))
+                return false;
+            while(more() && is_digit(*p_))
+                ++p_;
+        }
+        return true;
+    }
+
+    bool
+    array()
+    {
+        ++p_; // opening bracket
+        skip_space();
+        if(more() && *p_ == ']')
+        {
+            ++p_;
+            return true;
+        }
+        for(;;)
+        {
+            if(! value())
+                return false;
+            skip_space();
+            if(! more())
+                return false;
+            if(*p_ == ']')
+            {
+                ++p_;
+                return true;
+            }
+            if(*p_++ != ',')
+                return false;
+        }
+    }
+
+    bool
+    object()
+    {
+        ++p_; // opening brace
+        skip_space();
+        if(more() && *p_ == '}')
+        {
+            ++p_;
+            return true;
+        }
+        for(;;)
+        {
+            skip_space();
+            if(! more() || *p_ != '"' || ! string())
+                return false;
+            skip_space();
+            if(! more() || *p_++ != ':')
+                return false;
+            if(! value())
+                return false;
+            skip_space();
+            if(! more())
+                return false;
+            if(*p_ == '}')
+            {
+                ++p_;
+                return true;
+            }
+            if(*p_++ != ',')
+                return false;
+        }
+    }
+
+public:
+    explicit
+    validator(beast::string_view s) noexcept
+        : p_(s.data())
+        , end_(s.data() + s.size())
+    {
+    }
+
+    bool
+    value()
+    {
+        skip_space();
+        if(! more())
+            return false;
+        switch(*p_)
+        {
+        case '{':
+        case '[':
+        {
+            if(++depth_ > max_depth)
+                return false;
+            auto const ok = *p_ == '{' ? object() : array();
+            --depth_;
+            return ok;
+        }
+        case '"':
+            return string();
+        case 't':
+            return literal("true");
+        case 'f':
+            return literal("false");
+        case 'n':
+            return literal("null");
+        default:
+            return number();
+        }
+    }
+
+    // Returns `true` if nothing but whitespace remains
+    bool
+    done() noexcept
+    {
+        skip_space();
+        return ! more();
+    }
+};
+
+} // namespace
+
+bool
+is_json_object(beast::string_view s)
+{
+    // Check the first character before doing any real work
+    auto const pos = s.find_first_not_of(" \t\r\n");
+    if(pos == beast::string_view::npos || s[pos] != '{')
+        return false;
+    validator v(s);
+    return v.value() && v.done();
+}
@@ -0,0 +1,23 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_JSON_HPP
+#define CPPCON2018_JSON_HPP
+
+#include "beast.hpp"
+
+/** Returns `true` if the text is a single well-formed JSON object.
+
+    Only the syntax is checked, nothing is allocated. Objects
+    nested more deeply than a fixed limit are rejected.
+*/
+bool
+is_json_object(beast::string_view s);
+
+#endif
@@ -9,7 +9,24 @@
 
 #include "listener.hpp"
 #include "http_session.hpp"
+#include <algorithm>
 #include <iostream>
+#ifndef BOOST_ASIO_WINDOWS
+#include <unistd.h>
+#endif
+
+namespace {
+
+// How often to check again while the server is full
+std::chrono::milliseconds constexpr full_retry{10};
+
+// How long to wait after an accept fails, as when out of descriptors
+std::chrono::milliseconds constexpr error_retry{100};
+
+// How often to measure the event loop lag
+std::chrono::milliseconds constexpr probe_interval{100};
+
+} // namespace
 
 listener::
 listener(
@@ -19,6 +36,8 @@ listener(
     : acceptor_(ioc)
     , socket_(ioc)
     , state_(state)
+    , timer_(ioc)
+    , probe_(ioc)
 {
     error_code ec;
 
@@ -56,17 +75,59 @@ listener(
     }
 }
 
+listener::
+listener(
+    net::io_context& ioc,
+    tcp::endpoint endpoint,
+    tcp::acceptor::native_handle_type handle,
+    std::shared_ptr<shared_state> const& state)
+    : acceptor_(ioc)
+    , socket_(ioc)
+    , state_(state)
+    , timer_(ioc)
+    , probe_(ioc)
+{
+    error_code ec;
+
+    // Take ownership of the socket, which is already listening
+    acceptor_.assign(endpoint.protocol(), handle, ec);
+    if(ec)
+    {
+        fail(ec, "assign");
+
+        // The handle is still ours to close
+#ifdef BOOST_ASIO_WINDOWS
+        ::closesocket(handle);
+#else
+        ::close(handle);
+#endif
+        return;
+    }
+}
+
 void
 listener::
 run()
 {
-    // Start accepting a connection
-    acceptor_.async_accept(
-        socket_,
-        [self = shared_from_this()](error_code ec)
-        {
-            self->on_accept(ec);
-        });
+    // Start with a full second of accepts
+    tokens_ = static_cast<double>(state_->accept_rate());
+    refill_ = std::chrono::steady_clock::now();
+
+    if(state_->max_lag().count() != 0)
+        do_probe();
+
+    do_accept();
+}
+
+void
+listener::
+stop()
+{
+    // Pending accepts complete with operation_aborted
+    error_code ec;
+    acceptor_.close(ec);
+    timer_.cancel();
+    probe_.cancel();
 }
 
 // Report a failure
@@ -80,24 +141,102 @@ fail(error_code ec, char const* what)
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
+// Accept a connection, unless we are full or accepting too fast.
+// Meanwhile new connections wait in the listen backlog, and the
+// sessions we have are not slowed down by taking on more.
+void
+listener::
+do_accept()
+{
+    if(! state_->accepting())
+        return wait(full_retry);
+
+    if(auto const rate = state_->accept_rate())
+    {
+        // Refill the tokens, allowing bursts of up to a second
+        auto const now = std::chrono::steady_clock::now();
+        tokens_ = std::min(
+            static_cast<double>(rate),
+            tokens_ + rate * std::chrono::duration<double>(now - refill_).count());
+        refill_ = now;
+        if(tokens_ < 1)
+            return wait(std::chrono::duration_cast<
+                std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>((1 - tokens_) / rate)));
+        tokens_ -= 1;
+    }
+
+    acceptor_.async_accept(
+        socket_,
+        [self = shared_from_this()](error_code ec)
+        {
+            self->on_accept(ec);
+        });
+}
+
+// Try accepting again after a delay
+void
+listener::
+wait(std::chrono::steady_clock::duration d)
+{
+    timer_.expires_after(d);
+    timer_.async_wait(
+        [self = shared_from_this()](error_code ec)
+        {
+            if(! ec && self->acceptor_.is_open())
+                self->do_accept();
+        });
+}
+
 // Handle a connection
 void
 listener::
 on_accept(error_code ec)
 {
     if(ec)
-        return fail(ec, "accept");
-    else
-        // Launch a new session for this connection
-        std::make_shared<http_session>(
-            std::move(socket_),
-            state_)->run();
+    {
+        // We were stopped
+        if(! acceptor_.is_open())
+            return;
+
+        // Errors such as running out of file descriptors
+        // are transient, so keep accepting after a pause.
+        fail(ec, "accept");
+        return wait(error_retry);
+    }
+
+    // Launch a new session for this connection
+    std::make_shared<http_session>(
+        std::move(socket_),
+        state_)->run();
 
     // Accept another connection
-    acceptor_.async_accept(
-        socket_,
+    do_accept();
+}
+
+// Schedule a timer, and see how late it runs
+void
+listener::
+do_probe()
+{
+    probe_.expires_after(probe_interval);
+    probe_.async_wait(
         [self = shared_from_this()](error_code ec)
         {
-            self->on_accept(ec);
+            self->on_probe(ec);
         });
 }
+
+void
+listener::
+on_probe(error_code ec)
+{
+    if(ec)
+        return;
+
+    state_->loop_lag(std::max(
+        std::chrono::steady_clock::now() - probe_.expiry(),
+        std::chrono::steady_clock::duration::zero()));
+
+    do_probe();
+}
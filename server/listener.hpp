@@ -11,6 +11,7 @@
 #define CPPCON2018_LISTENER_HPP
 
 #include "net.hpp"
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -24,8 +25,22 @@ class listener : public std::enable_shared_from_this<listener>
     tcp::socket socket_;
     std::shared_ptr<shared_state> state_;
 
+    // Paces accepts when the server is full or rate limited
+    net::steady_timer timer_;
+
+    // Measures how late the event loop runs
+    net::steady_timer probe_;
+
+    // Accepts allowed before the rate limit applies
+    double tokens_ = 0;
+    std::chrono::steady_clock::time_point refill_;
+
     void fail(error_code ec, char const* what);
+    void do_accept();
+    void wait(std::chrono::steady_clock::duration d);
     void on_accept(error_code ec);
+    void do_probe();
+    void on_probe(error_code ec);
 
 public:
     listener(
@@ -33,8 +48,31 @@ public:
         tcp::endpoint endpoint,
         std::shared_ptr<shared_state> const& state);
 
+    // Adopt a listening socket handed over by another process
+    listener(
+        net::io_context& ioc,
+        tcp::endpoint endpoint,
+        tcp::acceptor::native_handle_type handle,
+        std::shared_ptr<shared_state> const& state);
+
+    // Returns `true` if the listening socket is open
+    bool
+    is_open() const
+    {
+        return acceptor_.is_open();
+    }
+
     // Start accepting incoming connections
     void run();
+
+    // Stop accepting incoming connections
+    void stop();
+
+    tcp::acceptor::native_handle_type
+    native_handle()
+    {
+        return acceptor_.native_handle();
+    }
 };
 
 #endif
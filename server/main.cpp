@@ -15,35 +15,251 @@
 */
 //------------------------------------------------------------------------------
 
+#include "handoff.hpp"
 #include "listener.hpp"
+#include "recorder.hpp"
 #include "shared_state.hpp"
 #include <boost/asio/signal_set.hpp>
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+
+namespace {
+
+void
+usage()
+{
+    std::cerr <<
+        "Usage: websocket-chat-server <address> <port> <doc_root> [options]\n" <<
+        "Options:\n" <<
+        "    --batch-ms <ms>             combine messages sent within this window\n" <<
+        "    --batch-limit <n>           most messages in a batch (default 64)\n" <<
+        "    --handoff <path>            hand the listening socket over through this path\n" <<
+        "    --capture <path>            record the traffic to this file, or to <path>.<pid>\n" <<
+        "                                when taking over through --handoff\n" <<
+        "    --max-connections <n>       most open connections\n" <<
+        "    --accept-rate <n>           most connections accepted per second\n" <<
+        "    --max-handshakes <n>        most WebSocket handshakes in progress\n" <<
+        "    --max-lag-ms <ms>           refuse upgrades while the event loop lags this much\n" <<
+        "    --max-queued-kb <kb>        refuse upgrades while this much waits to be sent\n" <<
+        "    --relay-threshold-kb <kb>   stream longer messages in chunks of this size (default 64)\n" <<
+        "    --relay-backlog <n>         pause a sender while a recipient has this many chunks (default 4)\n" <<
+        "    --relay-timeout-ms <ms>     disconnect whoever holds up a relay this long (default 10000)\n" <<
+        "A limit of 0 means no limit.\n" <<
+        "Example:\n" <<
+        "    websocket-chat-server 0.0.0.0 8080 .\n" <<
+        "    websocket-chat-server 0.0.0.0 8080 . --batch-ms 5 --batch-limit 64\n" <<
+        "    websocket-chat-server 0.0.0.0 8080 . --handoff /tmp/lounge.sock\n" <<
+        "    websocket-chat-server 0.0.0.0 8080 . --capture traffic.cap\n" <<
+        "    websocket-chat-server 0.0.0.0 8080 . --max-connections 10000 --accept-rate 500\n";
+}
+
+// Parse a whole non-negative decimal number no larger than `max`
+bool
+parse_number(char const* s, std::size_t max, std::size_t& n)
+{
+    if(*s < '0' || *s > '9')
+        return false;
+    errno = 0;
+    char* end;
+    auto const v = std::strtoull(s, &end, 10);
+    if(*end != 0 || errno == ERANGE || v > max)
+        return false;
+    n = static_cast<std::size_t>(v);
+    return true;
+}
+
+} // namespace
 
 int
 main(int argc, char* argv[])
 {
     // Check command line arguments.
-    if (argc != 4)
+    if (argc < 4)
     {
-        std::cerr <<
-            "Usage: websocket-chat-server <address> <port> <doc_root>\n" <<
-            "Example:\n" <<
-            "    websocket-chat-server 0.0.0.0 8080 .\n";
+        usage();
         return EXIT_FAILURE;
     }
     auto address = net::ip::make_address(argv[1]);
-    auto port = static_cast<unsigned short>(std::atoi(argv[2]));
+    std::size_t port_number;
+    if(! parse_number(argv[2], 65535, port_number))
+    {
+        std::cerr << argv[2] << ": invalid port\n";
+        usage();
+        return EXIT_FAILURE;
+    }
+    auto port = static_cast<unsigned short>(port_number);
     auto doc_root = argv[3];
+    std::size_t batch_ms = 0;
+    std::size_t batch_limit = 64;
+    std::string handoff_path;
+    std::string capture_path;
+    std::size_t max_connections = 0;
+    std::size_t accept_rate = 0;
+    std::size_t max_handshakes = 0;
+    std::size_t max_lag_ms = 0;
+    std::size_t max_queued_kb = 0;
+    std::size_t relay_threshold_kb = 64;
+    std::size_t relay_backlog = 4;
+    std::size_t relay_timeout_ms = 10000;
+
+    // Large enough for any limit, small enough to scale without overflow
+    std::size_t const max_value =
+        (std::numeric_limits<std::size_t>::max)() / (1024 * 1024);
+
+    // Each option is followed by its value
+    for(int i = 4; i < argc; i += 2)
+    {
+        std::string const name = argv[i];
+        if(i + 1 == argc)
+        {
+            std::cerr << name << ": missing value\n";
+            return EXIT_FAILURE;
+        }
+        char const* value = argv[i + 1];
+        std::size_t* number = nullptr;
+        if(name == "--batch-ms")
+            number = &batch_ms;
+        else if(name == "--batch-limit")
+            number = &batch_limit;
+        else if(name == "--handoff")
+            handoff_path = value;
+        else if(name == "--capture")
+            capture_path = value;
+        else if(name == "--max-connections")
+            number = &max_connections;
+        else if(name == "--accept-rate")
+            number = &accept_rate;
+        else if(name == "--max-handshakes")
+            number = &max_handshakes;
+        else if(name == "--max-lag-ms")
+            number = &max_lag_ms;
+        else if(name == "--max-queued-kb")
+            number = &max_queued_kb;
+        else if(name == "--relay-threshold-kb")
+            number = &relay_threshold_kb;
+        else if(name == "--relay-backlog")
+            number = &relay_backlog;
+        else if(name == "--relay-timeout-ms")
+            number = &relay_timeout_ms;
+        else
+        {
+            std::cerr << name << ": unknown option\n";
+            usage();
+            return EXIT_FAILURE;
+        }
+
+        // A mistyped limit must not quietly mean "no limit"
+        if(number && ! parse_number(value, max_value, *number))
+        {
+            std::cerr << name << ": invalid value " << value << "\n";
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(relay_threshold_kb == 0)
+    {
+        std::cerr << "--relay-threshold-kb: must be at least 1\n";
+        return EXIT_FAILURE;
+    }
+
+    auto state = std::make_shared<shared_state>(doc_root);
+
+    // Stream large messages, holding the sender to its recipients' pace
+    state->relay_threshold(relay_threshold_kb * 1024);
+    state->relay_limits(
+        relay_backlog,
+        std::chrono::milliseconds(relay_timeout_ms));
+
+    // Optionally combine outgoing messages into batches
+    if(batch_ms > 0 && batch_limit > 1)
+        state->batch(
+            std::chrono::milliseconds(batch_ms),
+            batch_limit);
+
+    // Limit the load new connections may add, so that under
+    // overload the sessions we already have stay responsive.
+    state->limit_connections(max_connections, accept_rate);
+    state->limit_upgrades(
+        max_handshakes,
+        std::chrono::milliseconds(max_lag_ms),
+        max_queued_kb * 1024);
 
     // The io_context is required for all I/O
     net::io_context ioc;
 
-    // Create and launch a listening port
-    std::make_shared<listener>(
-        ioc,
-        tcp::endpoint{address, port},
-        std::make_shared<shared_state>(doc_root))->run();
+    // Create and launch a listening port, taking it over
+    // from a running server if one is waiting to hand off.
+    std::shared_ptr<listener> l;
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    net::local::stream_protocol::socket previous(ioc);
+    if(! handoff_path.empty())
+    {
+        error_code ec;
+        auto const fd = handoff::receive(handoff_path, previous, ec);
+        if(fd != -1)
+        {
+            l = std::make_shared<listener>(
+                ioc, tcp::endpoint{address, port}, fd, state);
+
+            // Without an acknowledgement the running process
+            // keeps serving, so give up and leave it to it.
+            if(! l->is_open())
+                return EXIT_FAILURE;
+
+            // The running process is still writing its capture
+            // while it drains, so ours goes to a file of its own.
+            if(! capture_path.empty())
+                capture_path += "." + std::to_string(::getpid());
+        }
+        else if(
+            ec != net::error::connection_refused &&
+            ec != boost::system::errc::no_such_file_or_directory)
+            std::cerr << "handoff receive: " << ec.message() << "\n";
+    }
+#else
+    if(! handoff_path.empty())
+        std::cerr << "handoff: not supported on this platform\n";
+#endif
+    if(! l)
+        l = std::make_shared<listener>(
+            ioc, tcp::endpoint{address, port}, state);
+
+    // Optionally record the traffic for replay
+    if(! capture_path.empty())
+    {
+        error_code ec;
+        auto r = std::make_shared<recorder>(capture_path, ec);
+        if(ec)
+        {
+            std::cerr << "capture: " << ec.message() << "\n";
+            return EXIT_FAILURE;
+        }
+        state->capture(std::move(r));
+    }
+
+    l->run();
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    // Let the previous process stop, now that we are accepting
+    if(previous.is_open())
+    {
+        error_code ec;
+        handoff::acknowledge(previous, ec);
+        if(ec)
+            std::cerr << "handoff acknowledge: " << ec.message() << "\n";
+    }
+
+    // Wait for the next process to take over
+    if(! handoff_path.empty())
+        std::make_shared<handoff>(
+            ioc, handoff_path, l, state, std::chrono::seconds(30))->run();
+#endif
 
     // Capture SIGINT and SIGTERM to perform a clean shutdown
     net::signal_set signals(ioc, SIGINT, SIGTERM);
@@ -59,7 +275,8 @@ main(int argc, char* argv[])
     // Run the I/O service on the main thread
     ioc.run();
 
-    // (If we get here, it means we got a SIGINT or SIGTERM)
+    // (If we get here, it means we got a SIGINT or SIGTERM,
+    // or another process took over and our sessions drained)
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_MIME_TYPES_HPP
+#define CPPCON2018_MIME_TYPES_HPP
+
+#include "beast.hpp"
+#include <cstddef>
+#include <cstdint>
+
+// Indexes of the content types we serve, returned by mime_index().
+// The first one is used for unknown extensions.
+enum mime_id : unsigned char
+{
+    mime_default,
+    mime_html,
+    mime_css,
+    mime_text,
+    mime_javascript,
+    mime_json,
+    mime_xml,
+    mime_flash,
+    mime_flv,
+    mime_png,
+    mime_jpeg,
+    mime_gif,
+    mime_bmp,
+    mime_icon,
+    mime_tiff,
+    mime_svg,
+    mime_count
+};
+
+// The content types, in the order of mime_id
+constexpr char const* mime_types[] = {
+    "application/text",
+    "text/html",
+    "text/css",
+    "text/plain",
+    "application/javascript",
+    "application/json",
+    "application/xml",
+    "application/x-shockwave-flash",
+    "video/x-flv",
+    "image/png",
+    "image/jpeg",
+    "image/gif",
+    "image/bmp",
+    "image/vnd.microsoft.icon",
+    "image/tiff",
+    "image/svg+xml"
+};
+
+static_assert(sizeof(mime_types) / sizeof(mime_types[0]) == mime_count,
+    "mime_types must have one entry for each mime_id");
+
+namespace detail {
+
+constexpr
+std::size_t
+mime_strlen(char const* s)
+{
+    std::size_t n = 0;
+    while(s[n])
+        ++n;
+    return n;
+}
+
+struct mime_extension
+{
+    char const* ext;
+    std::size_t size;
+    mime_id type;
+
+    constexpr
+    mime_extension(char const* ext_, mime_id type_)
+        : ext(ext_)
+        , size(mime_strlen(ext_))
+        , type(type_)
+    {
+    }
+};
+
+constexpr mime_extension mime_extensions[] = {
+    { "htm",  mime_html },
+    { "html", mime_html },
+    { "php",  mime_html },
+    { "css",  mime_css },
+    { "txt",  mime_text },
+    { "js",   mime_javascript },
+    { "json", mime_json },
+    { "xml",  mime_xml },
+    { "swf",  mime_flash },
+    { "flv",  mime_flv },
+    { "png",  mime_png },
+    { "jpe",  mime_jpeg },
+    { "jpeg", mime_jpeg },
+    { "jpg",  mime_jpeg },
+    { "gif",  mime_gif },
+    { "bmp",  mime_bmp },
+    { "ico",  mime_icon },
+    { "tiff", mime_tiff },
+    { "tif",  mime_tiff },
+    { "svg",  mime_svg },
+    { "svgz", mime_svg }
+};
+
+std::size_t constexpr mime_extension_count =
+    sizeof(mime_extensions) / sizeof(mime_extensions[0]);
+
+// The longest extension in the table
+constexpr
+std::size_t
+mime_longest()
+{
+    std::size_t n = 0;
+    for(auto const& e : mime_extensions)
+        if(e.size > n)
+            n = e.size;
+    return n;
+}
+
+std::size_t constexpr mime_max_extension = mime_longest();
+
+// Slots in the hash table, a power of two
+std::size_t constexpr mime_slots = 64;
+
+// FNV-1a of the lower-cased extension, mixed with a seed
+constexpr
+std::uint32_t
+mime_hash(char const* s, std::size_t n, std::uint32_t seed)
+{
+    std::uint32_t h = 2166136261u ^ seed;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        auto c = static_cast<unsigned char>(s[i]);
+        if(c >= 'A' && c <= 'Z')
+            c = static_cast<unsigned char>(c + ('a' - 'A'));
+        h = (h ^ c) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+// Maps a hash slot to one plus the index of its extension, or zero
+struct mime_table
+{
+    unsigned char slot[mime_slots];
+};
+
+constexpr
+mime_table
+make_mime_table(std::uint32_t seed)
+{
+    mime_table t{};
+    for(std::size_t i = 0; i < mime_extension_count; ++i)
+    {
+        auto const& e = mime_extensions[i];
+        t.slot[mime_hash(e.ext, e.size, seed) % mime_slots] =
+            static_cast<unsigned char>(i + 1);
+    }
+    return t;
+}
+
+// Returns `true` if no two extensions share a slot
+constexpr
+bool
+is_perfect(std::uint32_t seed)
+{
+    auto const t = make_mime_table(seed);
+    std::size_t used = 0;
+    for(std::size_t i = 0; i < mime_slots; ++i)
+        if(t.slot[i] != 0)
+            ++used;
+    return used == mime_extension_count;
+}
+
+// The first seed giving a perfect hash, found when compiling
+constexpr
+std::uint32_t
+find_mime_seed()
+{
+    std::uint32_t seed = 0;
+    while(! is_perfect(seed))
+        ++seed;
+    return seed;
+}
+
+std::uint32_t constexpr mime_seed = find_mime_seed();
+
+constexpr mime_table mime_lookup = make_mime_table(mime_seed);
+
+static_assert(is_perfect(mime_seed),
+    "mime extension table has collisions");
+
+} // detail
+
+// Return the index of a reasonable mime type based on the extension of a file.
+inline
+std::size_t
+mime_index(beast::string_view path)
+{
+    auto const pos = path.rfind('.');
+    if(pos == beast::string_view::npos)
+        return mime_default;
+    auto const ext = path.substr(pos + 1);
+    if(ext.empty() || ext.size() > detail::mime_max_extension)
+        return mime_default;
+    auto const i = detail::mime_lookup.slot[detail::mime_hash(
+        ext.data(), ext.size(), detail::mime_seed) % detail::mime_slots];
+    if(i == 0)
+        return mime_default;
+    auto const& e = detail::mime_extensions[i - 1];
+    if(! beast::iequals(ext, beast::string_view(e.ext, e.size)))
+        return mime_default;
+    return e.type;
+}
+
+#endif
@@ -0,0 +1,162 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "recorder.hpp"
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+char const signature[8] = {'L', 'O', 'U', 'N', 'G', 'E', 'C', '1'};
+
+// Append an unsigned LEB128 varint
+void
+put_varint(char*& p, std::uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        *p++ = static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    *p++ = static_cast<char>(v);
+}
+
+// Read an unsigned LEB128 varint, returning false at end of file
+bool
+get_varint(std::FILE* f, std::uint64_t& v)
+{
+    v = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7)
+    {
+        auto const c = std::fgetc(f);
+        if(c == EOF)
+            return false;
+        v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+        if((c & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+recorder::
+recorder(std::string const& path, error_code& ec)
+    : file_(std::fopen(path.c_str(), "wb"))
+    , last_(std::chrono::steady_clock::now())
+{
+    if(! file_ ||
+        std::fwrite(signature, 1, sizeof(signature), file_) != sizeof(signature))
+    {
+        ec = error_code(errno, boost::system::generic_category());
+        return;
+    }
+    ec = {};
+}
+
+recorder::
+~recorder()
+{
+    if(file_)
+        std::fclose(file_);
+}
+
+void
+recorder::
+write(type kind, std::uint64_t session, std::uint64_t size)
+{
+    if(! file_)
+        return;
+
+    auto const now = std::chrono::steady_clock::now();
+    auto const delta = std::chrono::duration_cast<
+        std::chrono::microseconds>(now - last_).count();
+    last_ = now;
+
+    char buf[1 + 3 * 10];
+    char* p = buf;
+    *p++ = static_cast<char>(kind);
+    put_varint(p, static_cast<std::uint64_t>(delta));
+    put_varint(p, session);
+    if(kind == type::message)
+        put_varint(p, size);
+    std::fwrite(buf, 1, static_cast<std::size_t>(p - buf), file_);
+}
+
+std::uint64_t
+recorder::
+connect()
+{
+    auto const id = next_id_++;
+    write(type::connect, id, 0);
+    return id;
+}
+
+void
+recorder::
+disconnect(std::uint64_t session)
+{
+    write(type::disconnect, session, 0);
+}
+
+void
+recorder::
+message(std::uint64_t session, std::uint64_t size)
+{
+    write(type::message, session, size);
+}
+
+std::vector<recorder::event>
+recorder::
+read(std::string const& path, error_code& ec)
+{
+    std::vector<event> v;
+    auto f = std::fopen(path.c_str(), "rb");
+    if(! f)
+    {
+        ec = error_code(errno, boost::system::generic_category());
+        return v;
+    }
+
+    char sig[sizeof(signature)];
+    if( std::fread(sig, 1, sizeof(sig), f) != sizeof(sig) ||
+        std::memcmp(sig, signature, sizeof(sig)) != 0)
+    {
+        std::fclose(f);
+        ec = boost::system::errc::make_error_code(
+            boost::system::errc::invalid_argument);
+        return v;
+    }
+
+    std::chrono::microseconds time{0};
+    for(;;)
+    {
+        auto const c = std::fgetc(f);
+        if(c == EOF)
+            break;
+        event e;
+        e.kind = static_cast<type>(c);
+        e.size = 0;
+        std::uint64_t delta;
+        if( c < 1 || c > 3 ||
+            ! get_varint(f, delta) ||
+            ! get_varint(f, e.session) ||
+            (e.kind == type::message && ! get_varint(f, e.size)))
+        {
+            // A truncated or corrupt record ends the capture
+            break;
+        }
+        time += std::chrono::microseconds(delta);
+        e.time = time;
+        v.push_back(e);
+    }
+    std::fclose(f);
+    ec = {};
+    return v;
+}
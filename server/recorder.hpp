@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_RECORDER_HPP
+#define CPPCON2018_RECORDER_HPP
+
+#include "net.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/** Records the shape of WebSocket traffic to a file.
+
+    Only the timing of connects and disconnects, and the
+    timing and size of each inbound message are written;
+    message contents are not. The file starts with an eight
+    byte signature followed by one record per event:
+
+        type        1 byte: connect, disconnect, or message
+        delta       varint: microseconds since the previous record
+        session     varint: id assigned at connect, starting at 1
+        size        varint: message size, for messages only
+*/
+class recorder
+{
+public:
+    enum class type : std::uint8_t
+    {
+        connect = 1,
+        disconnect = 2,
+        message = 3
+    };
+
+    // A recorded event with its time since the start of the capture
+    struct event
+    {
+        type kind;
+        std::chrono::microseconds time;
+        std::uint64_t session;
+        std::uint64_t size;
+    };
+
+private:
+    std::FILE* file_ = nullptr;
+    std::chrono::steady_clock::time_point last_;
+    std::uint64_t next_id_ = 1;
+
+    void write(type kind, std::uint64_t session, std::uint64_t size);
+
+public:
+    recorder(recorder const&) = delete;
+    recorder& operator=(recorder const&) = delete;
+
+    // Create the capture file, replacing any existing one
+    recorder(std::string const& path, error_code& ec);
+
+    ~recorder();
+
+    // Record a new session, returning its id
+    std::uint64_t connect();
+
+    void disconnect(std::uint64_t session);
+    void message(std::uint64_t session, std::uint64_t size);
+
+    // Read every event from a capture file
+    static
+    std::vector<event>
+    read(std::string const& path, error_code& ec);
+};
+
+#endif
@@ -0,0 +1,192 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "response_fields.hpp"
+#include "mime_types.hpp"
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+// The statuses which have templates
+unsigned const template_statuses[] = {
+    200, 206, 304, 400, 404, 416, 500, 503 };
+
+std::size_t constexpr status_count =
+    sizeof(template_statuses) / sizeof(template_statuses[0]);
+
+// A pre-serialized status line, Server, and Content-Type
+struct header_template
+{
+    std::string text;
+
+    // Offset of the CRLF ending the status line
+    std::size_t rest;
+};
+
+// Build every template once, for HTTP/1.1
+std::vector<header_template>
+make_templates()
+{
+    std::vector<header_template> v;
+    v.reserve(status_count * (mime_count + 1));
+    for(auto code : template_statuses)
+    {
+        for(std::size_t type = 0; type <= mime_count; ++type)
+        {
+            header_template t;
+            t.text = "HTTP/1.1 " + std::to_string(code) + " ";
+            auto const reason = http::obsolete_reason(
+                static_cast<http::status>(code));
+            t.text.append(reason.data(), reason.size());
+            t.rest = t.text.size();
+            t.text += "\r\nServer: " BOOST_BEAST_VERSION_STRING "\r\n";
+            if(type < mime_count)
+            {
+                t.text += "Content-Type: ";
+                t.text += mime_types[type];
+                t.text += "\r\n";
+            }
+            v.push_back(std::move(t));
+        }
+    }
+    return v;
+}
+
+header_template const&
+get_template(unsigned code, std::size_t type, bool& exact)
+{
+    static std::vector<header_template> const templates = make_templates();
+
+    std::size_t i = 0;
+    while(i < status_count && template_statuses[i] != code)
+        ++i;
+    exact = i < status_count;
+    if(! exact)
+        i = 0;
+    return templates[i * (mime_count + 1) + type];
+}
+
+} // namespace
+
+std::size_t const response_fields::no_content_type = mime_count;
+
+response_fields::
+response_fields()
+    : type_(no_content_type)
+{
+}
+
+// Remove the line holding a field, if any
+void
+response_fields::
+erase(http::field name)
+{
+    auto const s = http::to_string(name);
+    for(std::size_t pos = 0; pos < extra_.size();)
+    {
+        auto const end = extra_.find("\r\n", pos) + 2;
+        if( extra_.compare(pos, s.size(), s.data(), s.size()) == 0 &&
+            extra_.compare(pos + s.size(), 2, ": ") == 0)
+        {
+            extra_.erase(pos, end - pos);
+            return;
+        }
+        pos = end;
+    }
+}
+
+void
+response_fields::
+content_type(std::size_t type)
+{
+    type_ = type;
+    erase(http::field::content_type);
+}
+
+void
+response_fields::
+set(http::field name, beast::string_view value)
+{
+    if(name == http::field::content_type)
+        type_ = no_content_type;
+    erase(name);
+    auto const s = http::to_string(name);
+    extra_.append(s.data(), s.size());
+    extra_.append(": ");
+    extra_.append(value.data(), value.size());
+    extra_.append("\r\n");
+}
+
+response_fields::writer::
+writer(response_fields const& f,
+    unsigned version, unsigned code)
+{
+    bool exact;
+    auto const& t = get_template(code, f.type_, exact);
+
+    if(exact && version == 11 && f.reason_.empty())
+    {
+        // The whole template is sent as is
+        cb_[0] = net::buffer(t.text);
+        cb_[1] = {};
+        cb_[2] = {};
+    }
+    else
+    {
+        // Build the status line, then send the rest of the template
+        status_[0] = 'H';
+        status_[1] = 'T';
+        status_[2] = 'T';
+        status_[3] = 'P';
+        status_[4] = '/';
+        status_[5] = '0' + static_cast<char>(version / 10);
+        status_[6] = '.';
+        status_[7] = '0' + static_cast<char>(version % 10);
+        status_[8] = ' ';
+        status_[9] = '0' + static_cast<char>(code / 100);
+        status_[10]= '0' + static_cast<char>((code / 10) % 10);
+        status_[11]= '0' + static_cast<char>(code % 10);
+        status_[12]= ' ';
+        auto const reason = f.reason_.empty() ?
+            http::obsolete_reason(static_cast<http::status>(code)) :
+            beast::string_view(f.reason_);
+        cb_[0] = net::buffer(status_);
+        cb_[1] = net::buffer(reason.data(), reason.size());
+        cb_[2] = net::buffer(t.text.data() + t.rest, t.text.size() - t.rest);
+    }
+
+    cb_[3] = net::buffer(f.extra_);
+
+    if(f.content_length_)
+    {
+        auto const n = std::snprintf(length_, sizeof(length_),
+            "Content-Length: %llu\r\n",
+            static_cast<unsigned long long>(*f.content_length_));
+        cb_[4] = net::buffer(length_, static_cast<std::size_t>(n));
+    }
+    else if(f.chunked_)
+    {
+        cb_[4] = net::buffer("Transfer-Encoding: chunked\r\n", 28);
+    }
+    else
+    {
+        cb_[4] = {};
+    }
+
+    auto const keep_alive = f.get_keep_alive_impl(version);
+    if(version >= 11 && ! keep_alive)
+        cb_[5] = net::buffer("Connection: close\r\n", 19);
+    else if(version < 11 && keep_alive)
+        cb_[5] = net::buffer("Connection: keep-alive\r\n", 24);
+    else
+        cb_[5] = {};
+
+    cb_[6] = net::buffer("\r\n", 2);
+}
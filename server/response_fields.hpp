@@ -0,0 +1,157 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_RESPONSE_FIELDS_HPP
+#define CPPCON2018_RESPONSE_FIELDS_HPP
+
+#include "net.hpp"
+#include "beast.hpp"
+#include <boost/optional.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** A Fields container for responses built from templates.
+
+    The status line, the Server field, and the Content-Type
+    field of every response we send are pre-serialized once,
+    for each status and content type we use. When a response
+    is written the template is sent as is, followed by any
+    other fields and the Content-Length and Connection fields.
+
+    Fields other than the content type are kept in one string
+    already in serialized form, and cannot be read back.
+*/
+class response_fields
+{
+    std::string extra_;
+    std::string reason_;
+    std::size_t type_;
+    boost::optional<std::uint64_t> content_length_;
+    boost::optional<bool> keep_alive_;
+    bool chunked_ = false;
+
+    void erase(http::field name);
+
+public:
+    class writer;
+
+    // The index of "no content type" for content_type()
+    static std::size_t const no_content_type;
+
+    response_fields();
+
+    // Set the content type to an index of mime_types,
+    // replacing any Content-Type field which was set.
+    void content_type(std::size_t type);
+
+    // Set a field, replacing any previous value.
+    // Setting Content-Type replaces the template type.
+    void set(http::field name, beast::string_view value);
+
+    // Fields concept
+
+    beast::string_view
+    get_method_impl() const noexcept
+    {
+        return {};
+    }
+
+    beast::string_view
+    get_target_impl() const noexcept
+    {
+        return {};
+    }
+
+    beast::string_view
+    get_reason_impl() const noexcept
+    {
+        return reason_;
+    }
+
+    bool
+    get_chunked_impl() const noexcept
+    {
+        return chunked_;
+    }
+
+    bool
+    get_keep_alive_impl(unsigned version) const noexcept
+    {
+        return keep_alive_ ? *keep_alive_ : version >= 11;
+    }
+
+    bool
+    has_content_length_impl() const noexcept
+    {
+        return content_length_.has_value();
+    }
+
+    void
+    set_method_impl(beast::string_view) noexcept
+    {
+    }
+
+    void
+    set_target_impl(beast::string_view) noexcept
+    {
+    }
+
+    void
+    set_reason_impl(beast::string_view s)
+    {
+        reason_.assign(s.data(), s.size());
+    }
+
+    void
+    set_chunked_impl(bool value) noexcept
+    {
+        chunked_ = value;
+        if(value)
+            content_length_ = boost::none;
+    }
+
+    void
+    set_content_length_impl(
+        boost::optional<std::uint64_t> const& value) noexcept
+    {
+        content_length_ = value;
+        if(value)
+            chunked_ = false;
+    }
+
+    void
+    set_keep_alive_impl(unsigned, bool value) noexcept
+    {
+        keep_alive_ = value;
+    }
+};
+
+// Produces the serialized header
+class response_fields::writer
+{
+    std::array<net::const_buffer, 7> cb_;
+    char status_[13];
+    char length_[40];
+
+public:
+    using const_buffers_type = std::array<net::const_buffer, 7>;
+
+    writer(response_fields const& f,
+        unsigned version, unsigned code);
+
+    const_buffers_type
+    get() const
+    {
+        return cb_;
+    }
+};
+
+#endif
@@ -0,0 +1,232 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "shared_buffer.hpp"
+#include "size_pool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+struct shared_buffer::block
+{
+    std::size_t refs;
+    std::size_t size;
+    std::size_t capacity;
+    unsigned char cls;
+
+    char*
+    data() noexcept
+    {
+        return reinterpret_cast<char*>(this + 1);
+    }
+};
+
+namespace {
+
+// Size classes are powers of two from 64 bytes to 64 KiB
+std::size_t constexpr class_count = 11;
+unsigned char constexpr unpooled = 0xff;
+
+// Blocks this small are handed over by release() however little
+// they hold, since a pooled block of this size costs next to nothing
+std::size_t constexpr small_block = 4096;
+
+} // namespace
+
+size_pool&
+shared_buffer::
+local_pool() noexcept
+{
+    thread_local size_pool p(class_count, sizeof(block));
+    return p;
+}
+
+shared_buffer::block*
+shared_buffer::
+allocate(std::size_t capacity)
+{
+    auto& pool = local_pool();
+    auto const cls = pool.size_class(capacity);
+
+    block* p;
+    std::size_t n;
+    if(cls == pool.class_count())
+    {
+        n = capacity;
+        p = static_cast<block*>(::operator new(sizeof(block) + n));
+        p->cls = unpooled;
+    }
+    else
+    {
+        n = size_pool::class_size(cls);
+        p = static_cast<block*>(pool.allocate(cls));
+        p->cls = static_cast<unsigned char>(cls);
+    }
+
+    p->refs = 1;
+    p->size = 0;
+    p->capacity = n;
+    return p;
+}
+
+void
+shared_buffer::
+release(block* p) noexcept
+{
+    if(--p->refs > 0)
+        return;
+
+    // Return the block to this thread's freelist if there is room
+    if(p->cls != unpooled)
+        return local_pool().deallocate(p, p->cls);
+    ::operator delete(p);
+}
+
+shared_buffer::
+shared_buffer(std::size_t capacity)
+    : p_(allocate(capacity))
+{
+}
+
+shared_buffer::
+shared_buffer(beast::string_view s)
+    : p_(allocate(s.size()))
+{
+    if(! s.empty())
+        std::memcpy(p_->data(), s.data(), s.size());
+    p_->size = s.size();
+}
+
+shared_buffer::
+shared_buffer(shared_buffer const& other) noexcept
+    : p_(other.p_)
+{
+    if(p_)
+        ++p_->refs;
+}
+
+char*
+shared_buffer::
+data() noexcept
+{
+    return p_ ? p_->data() : nullptr;
+}
+
+char const*
+shared_buffer::
+data() const noexcept
+{
+    return p_ ? p_->data() : nullptr;
+}
+
+std::size_t
+shared_buffer::
+size() const noexcept
+{
+    return p_ ? p_->size : 0;
+}
+
+std::size_t
+shared_buffer::
+capacity() const noexcept
+{
+    return p_ ? p_->capacity : 0;
+}
+
+void
+shared_buffer::
+resize(std::size_t n) noexcept
+{
+    BOOST_ASSERT(p_ && n <= p_->capacity);
+    p_->size = n;
+}
+
+//------------------------------------------------------------------------------
+
+void
+receive_buffer::
+grow(std::size_t n)
+{
+    // Grow geometrically so a message arriving in many
+    // small pieces is copied only a few times.
+    shared_buffer b(std::max(n, 2 * capacity()));
+    if(size_ > 0)
+        std::memcpy(b.data(), buf_.data(), size_);
+    buf_ = std::move(b);
+}
+
+auto
+receive_buffer::
+prepare(std::size_t n) ->
+    mutable_buffers_type
+{
+    if(n > max_ - size_)
+        throw std::length_error{"receive_buffer overflow"};
+    if(size_ + n > capacity())
+        grow(size_ + n);
+    in_ = n;
+    return {buf_.data() + size_, n};
+}
+
+void
+receive_buffer::
+commit(std::size_t n) noexcept
+{
+    size_ += std::min(n, in_);
+    in_ = 0;
+}
+
+void
+receive_buffer::
+consume(std::size_t n) noexcept
+{
+    if(n >= size_)
+    {
+        size_ = 0;
+        return;
+    }
+    std::memmove(buf_.data(), buf_.data() + n, size_ - n);
+    size_ -= n;
+}
+
+void
+receive_buffer::
+reserve(std::size_t n)
+{
+    n = std::min(n, max_);
+    if(n > capacity())
+        grow(n);
+}
+
+shared_buffer
+receive_buffer::
+release()
+{
+    shared_buffer b;
+    if(! buf_)
+        return b;
+    if(capacity() > small_block && size_ * 4 < capacity())
+    {
+        // Copy a small message out of a large block, so the
+        // message does not pin it while being broadcast, and
+        // keep the large block for the next message.
+        b = shared_buffer(beast::string_view(buf_.data(), size_));
+    }
+    else
+    {
+        // Hand over the storage itself
+        b = std::move(buf_);
+        b.resize(size_);
+        buf_ = shared_buffer();
+    }
+    size_ = 0;
+    in_ = 0;
+    return b;
+}
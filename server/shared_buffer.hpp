@@ -0,0 +1,167 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_SHARED_BUFFER_HPP
+#define CPPCON2018_SHARED_BUFFER_HPP
+
+#include "net.hpp"
+#include "beast.hpp"
+#include <cstddef>
+#include <limits>
+#include <utility>
+
+// Forward declaration
+class size_pool;
+
+/** A reference counted buffer allocated from a pool.
+
+    Storage comes from per-thread freelists of size classes
+    from 64 bytes to 64 KiB, and returns there when the last
+    reference is released. Larger buffers use the heap.
+
+    Copies share the same storage. The reference count is
+    not atomic, so like the rest of the server state a buffer
+    and its copies must only be used from one thread.
+*/
+class shared_buffer
+{
+    struct block;
+
+    block* p_ = nullptr;
+
+    static size_pool& local_pool() noexcept;
+    static block* allocate(std::size_t capacity);
+    static void release(block* p) noexcept;
+
+public:
+    shared_buffer() = default;
+
+    // Allocate storage for at least `capacity` bytes
+    explicit
+    shared_buffer(std::size_t capacity);
+
+    // Allocate storage holding a copy of `s`
+    explicit
+    shared_buffer(beast::string_view s);
+
+    shared_buffer(shared_buffer const& other) noexcept;
+
+    shared_buffer(shared_buffer&& other) noexcept
+        : p_(other.p_)
+    {
+        other.p_ = nullptr;
+    }
+
+    shared_buffer&
+    operator=(shared_buffer other) noexcept
+    {
+        std::swap(p_, other.p_);
+        return *this;
+    }
+
+    ~shared_buffer()
+    {
+        if(p_)
+            release(p_);
+    }
+
+    explicit
+    operator bool() const noexcept
+    {
+        return p_ != nullptr;
+    }
+
+    char* data() noexcept;
+    char const* data() const noexcept;
+    std::size_t size() const noexcept;
+    std::size_t capacity() const noexcept;
+
+    // Set the size, which may not exceed the capacity
+    void resize(std::size_t n) noexcept;
+
+    bool
+    empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    beast::string_view
+    view() const noexcept
+    {
+        return {data(), size()};
+    }
+
+    net::const_buffer
+    buffer() const noexcept
+    {
+        return {data(), size()};
+    }
+};
+
+/** A DynamicBuffer which receives into a shared_buffer.
+
+    When a message is complete, `release` hands the storage
+    to the caller so it may be broadcast without copying.
+*/
+class receive_buffer
+{
+    shared_buffer buf_;
+    std::size_t size_ = 0;
+    std::size_t in_ = 0;
+    std::size_t max_;
+
+    void grow(std::size_t n);
+
+public:
+    using const_buffers_type = net::const_buffer;
+    using mutable_buffers_type = net::mutable_buffer;
+
+    explicit
+    receive_buffer(std::size_t max_size =
+        (std::numeric_limits<std::size_t>::max)())
+        : max_(max_size)
+    {
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+    std::size_t
+    max_size() const noexcept
+    {
+        return max_;
+    }
+
+    std::size_t
+    capacity() const noexcept
+    {
+        return buf_ ? buf_.capacity() : 0;
+    }
+
+    const_buffers_type
+    data() const noexcept
+    {
+        return {buf_ ? buf_.data() : nullptr, size_};
+    }
+
+    mutable_buffers_type prepare(std::size_t n);
+    void commit(std::size_t n) noexcept;
+    void consume(std::size_t n) noexcept;
+
+    // Make room for a total of `n` bytes without further growth
+    void reserve(std::size_t n);
+
+    // Return the readable bytes and leave the buffer empty
+    shared_buffer release();
+};
+
+#endif
@@ -8,6 +8,7 @@
 //
 
 #include "shared_state.hpp"
+#include "json.hpp"
 #include "websocket_session.hpp"
 
 shared_state::
@@ -16,6 +17,61 @@ shared_state(std::string doc_root)
 {
 }
 
+bool
+shared_state::
+admit_upgrade() const noexcept
+{
+    if(max_handshakes_ != 0 && handshakes_ >= max_handshakes_)
+        return false;
+    if(max_lag_.count() != 0 && lag_ >= max_lag_)
+        return false;
+    if(max_queued_ != 0 && queued_ >= max_queued_)
+        return false;
+    return true;
+}
+
+void
+shared_state::
+add_connection() noexcept
+{
+    ++connections_;
+}
+
+void
+shared_state::
+remove_connection() noexcept
+{
+    --connections_;
+}
+
+void
+shared_state::
+begin_handshake() noexcept
+{
+    ++handshakes_;
+}
+
+void
+shared_state::
+end_handshake() noexcept
+{
+    --handshakes_;
+}
+
+void
+shared_state::
+add_queued(std::size_t n) noexcept
+{
+    queued_ += n;
+}
+
+void
+shared_state::
+remove_queued(std::size_t n) noexcept
+{
+    queued_ -= n;
+}
+
 void
 shared_state::
 join(websocket_session& session)
@@ -32,10 +88,35 @@ leave(websocket_session& session)
 
 void
 shared_state::
-send(std::string message)
+send(shared_buffer message)
+{
+    // Only a well-formed object can be an element of a
+    // batch, since one bad message would spoil the array.
+    auto const batchable =
+        batch_window_.count() != 0 &&
+        is_json_object(message.view());
+    for(auto session : sessions_)
+        session->send(message, batchable);
+}
+
+std::vector<std::weak_ptr<websocket_session>>
+shared_state::
+sessions() const
 {
-    auto const ss = std::make_shared<std::string const>(std::move(message));
+    std::vector<std::weak_ptr<websocket_session>> v;
+    v.reserve(sessions_.size());
+    for(auto session : sessions_)
+        v.push_back(session->shared_from_this());
+    return v;
+}
 
+std::vector<std::shared_ptr<relay>>
+shared_state::
+open_relays()
+{
+    std::vector<std::shared_ptr<relay>> v;
+    v.reserve(sessions_.size());
     for(auto session : sessions_)
-        session->send(ss);
+        v.push_back(session->open_relay());
+    return v;
 }
@@ -10,13 +10,34 @@
 #ifndef CPPCON2018_SHARED_STATE_HPP
 #define CPPCON2018_SHARED_STATE_HPP
 
+#include "shared_buffer.hpp"
+#include <chrono>
+#include <cstddef>
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
-// Forward declaration
+// Forward declarations
+class recorder;
 class websocket_session;
 
+/** A message being streamed to one session while it is received.
+
+    The sender appends chunks as they arrive and sets `done`
+    after the last one. The chunks are shared by the relays
+    of every recipient, and each recipient releases a chunk
+    once it has been written, letting the sender read more.
+*/
+struct relay
+{
+    std::weak_ptr<websocket_session> session;
+    std::weak_ptr<websocket_session> sender;
+    std::deque<shared_buffer> chunks;
+    bool done = false;
+};
+
 // Represents the shared server state
 class shared_state
 {
@@ -27,6 +48,31 @@ class shared_state
     // strand (i.e. a single-threaded server)
     std::unordered_set<websocket_session*> sessions_;
 
+    // Outgoing message batching, disabled when the window is zero
+    std::chrono::milliseconds batch_window_{0};
+    std::size_t batch_limit_ = 0;
+
+    // Messages larger than this are streamed to recipients
+    std::size_t relay_threshold_ = 64 * 1024;
+    std::size_t relay_backlog_ = 4;
+    std::chrono::milliseconds relay_timeout_{10000};
+
+    // Records traffic when set
+    std::shared_ptr<recorder> capture_;
+
+    // Admission limits, zero when unlimited
+    std::size_t max_connections_ = 0;
+    std::size_t max_handshakes_ = 0;
+    std::size_t accept_rate_ = 0;
+    std::chrono::milliseconds max_lag_{0};
+    std::size_t max_queued_ = 0;
+
+    // Current load
+    std::size_t connections_ = 0;
+    std::size_t handshakes_ = 0;
+    std::chrono::steady_clock::duration lag_{};
+    std::size_t queued_ = 0;
+
 public:
     explicit
     shared_state(std::string doc_root);
@@ -37,9 +83,172 @@ public:
         return doc_root_;
     }
 
+    /** Enable batching of outgoing messages.
+
+        Messages for the same recipient which arrive within `window`
+        of the first are sent together as a single JSON-RPC batch
+        frame. A batch is sent early once it holds `limit` messages.
+        A zero window disables batching.
+    */
+    void
+    batch(std::chrono::milliseconds window, std::size_t limit) noexcept
+    {
+        batch_window_ = window;
+        batch_limit_ = limit;
+    }
+
+    std::chrono::milliseconds
+    batch_window() const noexcept
+    {
+        return batch_window_;
+    }
+
+    std::size_t
+    batch_limit() const noexcept
+    {
+        return batch_limit_;
+    }
+
+    /** Set the size above which messages are streamed.
+
+        Inbound messages are buffered up to this many bytes.
+        A longer message is forwarded to recipients in chunks
+        of at most this size while the rest is still arriving.
+    */
+    void
+    relay_threshold(std::size_t n) noexcept
+    {
+        relay_threshold_ = n;
+    }
+
+    std::size_t
+    relay_threshold() const noexcept
+    {
+        return relay_threshold_;
+    }
+
+    /** Limit how long a relayed message may hold up its recipients.
+
+        The sender stops reading while any recipient has `backlog`
+        chunks waiting. When no chunk is forwarded for `timeout`,
+        whoever holds up the relay is disconnected: the recipients
+        which fell behind, or else the sender. Zero means no limit.
+    */
+    void
+    relay_limits(
+        std::size_t backlog,
+        std::chrono::milliseconds timeout) noexcept
+    {
+        relay_backlog_ = backlog;
+        relay_timeout_ = timeout;
+    }
+
+    std::size_t
+    relay_backlog() const noexcept
+    {
+        return relay_backlog_;
+    }
+
+    std::chrono::milliseconds
+    relay_timeout() const noexcept
+    {
+        return relay_timeout_;
+    }
+
+    // Record the traffic of every session
+    void
+    capture(std::shared_ptr<recorder> r) noexcept
+    {
+        capture_ = std::move(r);
+    }
+
+    recorder*
+    capture() const noexcept
+    {
+        return capture_.get();
+    }
+
+    /** Limit the connections which are accepted.
+
+        No more than `max_connections` HTTP and WebSocket
+        connections are open at once, and no more than `rate`
+        are accepted per second. Connections over either limit
+        wait in the listen backlog. Zero means no limit.
+    */
+    void
+    limit_connections(std::size_t max_connections, std::size_t rate) noexcept
+    {
+        max_connections_ = max_connections;
+        accept_rate_ = rate;
+    }
+
+    std::size_t
+    accept_rate() const noexcept
+    {
+        return accept_rate_;
+    }
+
+    // Returns `true` if another connection may be accepted
+    bool
+    accepting() const noexcept
+    {
+        return max_connections_ == 0 || connections_ < max_connections_;
+    }
+
+    /** Limit the WebSocket upgrades which are accepted.
+
+        An upgrade is refused with 503 Service Unavailable when
+        `max_handshakes` handshakes are already in progress,
+        when the event loop runs `max_lag` or more behind, or
+        when `max_queued` or more bytes wait to be sent, counting
+        queued and batched messages and relayed chunks. Zero
+        means no limit.
+    */
+    void
+    limit_upgrades(
+        std::size_t max_handshakes,
+        std::chrono::milliseconds max_lag,
+        std::size_t max_queued) noexcept
+    {
+        max_handshakes_ = max_handshakes;
+        max_lag_ = max_lag;
+        max_queued_ = max_queued;
+    }
+
+    std::chrono::milliseconds
+    max_lag() const noexcept
+    {
+        return max_lag_;
+    }
+
+    // Returns `true` if a WebSocket upgrade may be accepted
+    bool admit_upgrade() const noexcept;
+
+    // Record how late the event loop ran a timer
+    void
+    loop_lag(std::chrono::steady_clock::duration lag) noexcept
+    {
+        lag_ = lag;
+    }
+
+    // Track open connections, handshakes in progress,
+    // and the bytes of messages waiting to be sent.
+    void add_connection     () noexcept;
+    void remove_connection  () noexcept;
+    void begin_handshake    () noexcept;
+    void end_handshake      () noexcept;
+    void add_queued         (std::size_t n) noexcept;
+    void remove_queued      (std::size_t n) noexcept;
+
     void join  (websocket_session& session);
     void leave (websocket_session& session);
-    void send  (std::string message);
+    void send  (shared_buffer message);
+
+    // Returns the active sessions
+    std::vector<std::weak_ptr<websocket_session>> sessions() const;
+
+    // Begin streaming a message to all sessions
+    std::vector<std::shared_ptr<relay>> open_relays();
 };
 
 #endif
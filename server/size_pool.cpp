@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#include "size_pool.hpp"
+#include <boost/assert.hpp>
+#include <new>
+
+size_pool::
+size_pool(std::size_t class_count, std::size_t header)
+    : lists_(new freelist[class_count])
+    , class_count_(class_count)
+    , header_(header)
+{
+}
+
+size_pool::
+~size_pool()
+{
+    for(std::size_t i = 0; i < class_count_; ++i)
+    {
+        auto& list = lists_[i];
+        while(list.head)
+        {
+            auto const p = list.head;
+            list.head = p->next;
+            ::operator delete(p);
+        }
+    }
+}
+
+std::size_t
+size_pool::
+size_class(std::size_t size) const noexcept
+{
+    std::size_t cls = 0;
+    std::size_t n = min_class_size;
+    while(cls < class_count_ && n < size)
+    {
+        ++cls;
+        n *= 2;
+    }
+    return cls;
+}
+
+void*
+size_pool::
+allocate(std::size_t cls)
+{
+    BOOST_ASSERT(cls < class_count_);
+    auto& list = lists_[cls];
+    if(list.head)
+    {
+        auto const p = list.head;
+        list.head = p->next;
+        --list.count;
+        return p;
+    }
+    return ::operator new(header_ + class_size(cls));
+}
+
+void
+size_pool::
+deallocate(void* p, std::size_t cls) noexcept
+{
+    BOOST_ASSERT(cls < class_count_);
+    auto& list = lists_[cls];
+    if(list.count < max_free)
+    {
+        auto const b = static_cast<free_block*>(p);
+        b->next = list.head;
+        list.head = b;
+        ++list.count;
+        return;
+    }
+    ::operator delete(p);
+}
@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2018 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/vinniefalco/CppCon2018
+//
+
+#ifndef CPPCON2018_SIZE_POOL_HPP
+#define CPPCON2018_SIZE_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+
+/** Freelists of memory blocks in power of two size classes.
+
+    Class `i` holds blocks of `header` bytes followed by
+    `64 << i` bytes. A freed block goes on the list of its
+    class, unless the list is full, and is handed out again
+    by the next allocation of that class.
+
+    A pool is not thread safe; give each thread its own.
+*/
+class size_pool
+{
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    struct freelist
+    {
+        free_block* head = nullptr;
+        std::size_t count = 0;
+    };
+
+    std::unique_ptr<freelist[]> lists_;
+    std::size_t class_count_;
+    std::size_t header_;
+
+public:
+    // The size of the smallest class
+    static std::size_t constexpr min_class_size = 64;
+
+    // The most free blocks kept per class
+    static std::size_t constexpr max_free = 256;
+
+    size_pool(std::size_t class_count, std::size_t header = 0);
+
+    ~size_pool();
+
+    size_pool(size_pool const&) = delete;
+    size_pool& operator=(size_pool const&) = delete;
+
+    std::size_t
+    class_count() const noexcept
+    {
+        return class_count_;
+    }
+
+    // Returns the smallest class which fits, or class_count() if none
+    std::size_t size_class(std::size_t size) const noexcept;
+
+    // Returns the size of the blocks in a class, after the header
+    static
+    std::size_t
+    class_size(std::size_t cls) noexcept
+    {
+        return min_class_size << cls;
+    }
+
+    // Allocate a block of a class
+    void* allocate(std::size_t cls);
+
+    // Free a block of a class
+    void deallocate(void* p, std::size_t cls) noexcept;
+};
+
+#endif
@@ -8,6 +8,9 @@
 //
 
 #include "websocket_session.hpp"
+#include "recorder.hpp"
+#include <cstring>
+#include <iostream>
 
 websocket_session::
 websocket_session(
@@ -15,7 +18,11 @@ websocket_session(
     std::shared_ptr<shared_state> const& state)
     : ws_(std::move(socket))
     , state_(state)
+    , timer_(ws_.get_executor())
+    , relay_timer_(ws_.get_executor())
 {
+    state_->add_connection();
+    state_->begin_handshake();
 }
 
 websocket_session::
@@ -23,6 +30,27 @@ websocket_session::
 {
     // Remove this session from the list of active sessions
     state_->leave(*this);
+
+    if(handshaking_)
+        state_->end_handshake();
+    for(auto const& m : queue_)
+    {
+        state_->remove_queued(m.message.size());
+        if(! m.stream)
+            continue;
+        for(auto const& c : m.stream->chunks)
+            state_->remove_queued(c.size());
+
+        // A sender waiting for this session may read again
+        if(auto sp = m.stream->sender.lock())
+            sp->drained();
+    }
+    for(auto const& m : batch_)
+        state_->remove_queued(m.size());
+    state_->remove_connection();
+
+    if(capture_id_ != 0)
+        state_->capture()->disconnect(capture_id_);
 }
 
 void
@@ -41,6 +69,9 @@ void
 websocket_session::
 on_accept(error_code ec)
 {
+    handshaking_ = false;
+    state_->end_handshake();
+
     // Handle the error, if any
     if(ec)
         return fail(ec, "accept");
@@ -48,9 +79,167 @@ on_accept(error_code ec)
     // Add this session to the list of active sessions
     state_->join(*this);
 
-    // Read a message
-    ws_.async_read(
+    if(auto r = state_->capture())
+        capture_id_ = r->connect();
+
+    // Read messages
+#if LOUNGE_COROUTINES
+    spawn(read_loop());
+#else
+    do_read();
+#endif
+}
+
+// Read no more than the relay threshold, so that
+// a large message never sits whole in the buffer.
+std::size_t
+websocket_session::
+read_limit() const
+{
+    auto const limit = state_->relay_threshold();
+    return limit > buffer_.size() ? limit - buffer_.size() : 1;
+}
+
+// Deliver what a read produced, as a whole message or a relayed part
+void
+websocket_session::
+consume(std::size_t bytes_transferred)
+{
+    message_size_ += bytes_transferred;
+
+    if(ws_.is_message_done())
+    {
+        if(capture_id_ != 0)
+            state_->capture()->message(capture_id_, message_size_);
+        message_size_ = 0;
+
+        // Send to all connections
+        if(! relaying_)
+        {
+            state_->send(buffer_.release());
+        }
+        else
+        {
+            forward(true);
+        }
+    }
+    else if(buffer_.size() >= state_->relay_threshold())
+    {
+        // The message is large, stream what we have so far
+        if(! relaying_)
+        {
+            relaying_ = true;
+            relays_ = state_->open_relays();
+            auto const self = shared_from_this();
+            for(auto const& r : relays_)
+                r->sender = self;
+        }
+        forward(false);
+    }
+}
+
+#if LOUNGE_COROUTINES
+
+task<>
+websocket_session::
+read_loop()
+{
+    auto self = shared_from_this();
+
+    for(;;)
+    {
+        // Wait while recipients catch up on a relayed message
+        if(backlogged())
+        {
+            stalled_ = true;
+            co_return;
+        }
+
+        auto [ec, bytes] = co_await ws_.async_read_some(
+            buffer_, read_limit(), use_task);
+
+        // Handle the error, if any
+        if(ec)
+        {
+            // Finish any message being relayed, so recipients
+            // are not left waiting for the rest of it.
+            forward(true);
+            fail(ec, "read");
+            co_return;
+        }
+
+        consume(bytes);
+    }
+}
+
+task<>
+websocket_session::
+write_loop()
+{
+    auto self = shared_from_this();
+
+    while(! queue_.empty())
+    {
+        error_code ec;
+        bool fin = true;
+
+        // The queue may grow while a write is pending, so
+        // elements are not referenced across a suspension.
+        if(! queue_.front().stream)
+        {
+            // Send a complete message
+            std::tie(ec, std::ignore) = co_await ws_.async_write(
+                queue_.front().message.buffer(), use_task);
+        }
+        else
+        {
+            // Send the next chunk of a relayed message,
+            // or wait for the sender to provide one.
+            auto& r = *queue_.front().stream;
+            if(r.chunks.empty() && ! r.done)
+                break;
+            fin = r.done && r.chunks.size() <= 1;
+            std::tie(ec, std::ignore) = co_await ws_.async_write_some(
+                fin,
+                r.chunks.empty() ?
+                    net::const_buffer{} :
+                    r.chunks.front().buffer(),
+                use_task);
+            if(! ec && ! r.chunks.empty())
+                release(r);
+        }
+
+        // Handle the error, if any
+        if(ec)
+        {
+            fail(ec, "write");
+            co_return;
+        }
+
+        // Remove the message once it is finished
+        if(fin)
+            pop();
+    }
+
+    writing_ = false;
+}
+
+#else
+
+void
+websocket_session::
+do_read()
+{
+    // Wait while recipients catch up on a relayed message
+    if(backlogged())
+    {
+        stalled_ = true;
+        return;
+    }
+
+    ws_.async_read_some(
         buffer_,
+        read_limit(),
         [sp = shared_from_this()](
             error_code ec, std::size_t bytes)
         {
@@ -60,67 +249,372 @@ on_accept(error_code ec)
 
 void
 websocket_session::
-on_read(error_code ec, std::size_t)
+on_read(error_code ec, std::size_t bytes_transferred)
 {
     // Handle the error, if any
     if(ec)
+    {
+        // Finish any message being relayed, so recipients
+        // are not left waiting for the rest of it.
+        forward(true);
         return fail(ec, "read");
+    }
 
-    // Send to all connections
-    state_->send(beast::buffers_to_string(buffer_.data()));
+    consume(bytes_transferred);
 
-    // Clear the buffer
-    buffer_.consume(buffer_.size());
+    // Read some more
+    do_read();
+}
 
-    // Read another message
-    ws_.async_read(
-        buffer_,
-        [sp = shared_from_this()](
-            error_code ec, std::size_t bytes)
+void
+websocket_session::
+on_write(error_code ec, std::size_t)
+{
+    // Handle the error, if any
+    if(ec)
+        return fail(ec, "write");
+
+    writing_ = false;
+
+    // Remove the chunk, and the message once it is finished
+    auto& m = queue_.front();
+    if(m.stream && ! m.stream->chunks.empty())
+        release(*m.stream);
+    if(fin_)
+        pop();
+
+    // Send the next message if any
+    do_write();
+}
+
+#endif
+
+// Pass the buffered part of a relayed message to each recipient
+void
+websocket_session::
+forward(bool done)
+{
+    if(! relaying_)
+        return;
+
+    auto const chunk = buffer_.release();
+
+    // The next chunk is read into a block of full size
+    // at once, rather than grown from a small one.
+    if(! done)
+        buffer_.reserve(state_->relay_threshold());
+
+    for(auto it = relays_.begin(); it != relays_.end();)
+    {
+        // Recipients which have gone away need nothing more
+        auto sp = (*it)->session.lock();
+        if(! sp)
         {
-            sp->on_read(ec, bytes);
+            it = relays_.erase(it);
+            continue;
+        }
+        if(! chunk.empty())
+        {
+            (*it)->chunks.push_back(chunk);
+            state_->add_queued(chunk.size());
+        }
+        (*it)->done = done;
+        sp->resume();
+        ++it;
+    }
+
+    if(done)
+    {
+        relaying_ = false;
+        relays_.clear();
+        relay_timer_.cancel();
+        return;
+    }
+
+    // Every chunk gives the relay more time
+    wait_relay();
+}
+
+// Start the deadline for forwarding the next chunk
+void
+websocket_session::
+wait_relay()
+{
+    // Without a timeout the timer only keeps the sender alive
+    if(state_->relay_timeout().count() == 0)
+        relay_timer_.expires_at((net::steady_timer::time_point::max)());
+    else
+        relay_timer_.expires_after(state_->relay_timeout());
+    relay_timer_.async_wait(
+        [sp = shared_from_this()](error_code ec)
+        {
+            sp->on_relay_timer(ec);
         });
 }
 
+// Returns `true` if a recipient has too much of the relayed message waiting
+bool
+websocket_session::
+backlogged() const
+{
+    if(state_->relay_backlog() == 0)
+        return false;
+    for(auto const& r : relays_)
+        if( r->chunks.size() >= state_->relay_backlog() &&
+            ! r->session.expired())
+            return true;
+    return false;
+}
+
+// Remove a chunk which was written, and let the sender know
+void
+websocket_session::
+release(relay& r)
+{
+    state_->remove_queued(r.chunks.front().size());
+    r.chunks.pop_front();
+    if(auto sp = r.sender.lock())
+        sp->drained();
+}
+
+void
+websocket_session::
+on_relay_timer(error_code ec)
+{
+    // The relay finished, or another chunk arrived
+    if(ec == net::error::operation_aborted || ! relaying_)
+        return;
+
+    fail(net::error::timed_out, "relay");
+
+    // A quiet sender holds up every recipient; the read
+    // fails and the recipients are given what there is.
+    if(! stalled_)
+        return abort();
+
+    // Otherwise disconnect the recipients which fell behind
+    for(auto it = relays_.begin(); it != relays_.end();)
+    {
+        if((*it)->chunks.size() >= state_->relay_backlog())
+        {
+            if(auto sp = (*it)->session.lock())
+                sp->abort();
+            it = relays_.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    // The rest get another interval
+    wait_relay();
+    drained();
+}
+
+void
+websocket_session::
+send(shared_buffer const& message, bool batchable)
+{
+    // For messages which cannot be batched, send
+    // whatever is pending and then this one.
+    if(! batchable)
+    {
+        flush();
+        return enqueue(message);
+    }
+
+    batch_.push_back(message);
+    state_->add_queued(message.size());
+
+    // Send a full batch right away
+    if(batch_.size() >= state_->batch_limit())
+        return flush();
+
+    // The first message of a batch starts the window
+    if(batch_.size() == 1)
+    {
+        timer_.expires_after(state_->batch_window());
+        timer_.async_wait(
+            [sp = shared_from_this()](error_code ec)
+            {
+                sp->on_timer(ec);
+            });
+    }
+}
+
+void
+websocket_session::
+flush()
+{
+    if(batch_.empty())
+        return;
+
+    // The batch is counted again once it is queued
+    for(auto const& m : batch_)
+        state_->remove_queued(m.size());
+
+    // A batch of one is sent as the bare message
+    if(batch_.size() == 1)
+    {
+        enqueue(batch_.front());
+    }
+    else
+    {
+        // Combine the messages into a JSON-RPC batch array
+        std::size_t n = batch_.size() + 1;
+        for(auto const& m : batch_)
+            n += m.size();
+        shared_buffer b(n);
+        auto p = b.data();
+        for(auto const& m : batch_)
+        {
+            *p = p == b.data() ? '[' : ',';
+            ++p;
+            std::memcpy(p, m.data(), m.size());
+            p += m.size();
+        }
+        *p = ']';
+        b.resize(n);
+        enqueue(b);
+    }
+    batch_.clear();
+    timer_.cancel();
+}
+
 void
 websocket_session::
-send(std::shared_ptr<std::string const> const& ss)
+on_timer(error_code ec)
+{
+    // The batch was already sent
+    if(ec == net::error::operation_aborted)
+        return;
+
+    flush();
+}
+
+void
+websocket_session::
+enqueue(shared_buffer const& message)
 {
     // Always add to queue
-    queue_.push_back(ss);
+    queue_.push_back({message, nullptr});
+    state_->add_queued(message.size());
 
-    // Are we already writing?
-    if(queue_.size() > 1)
+    do_write();
+}
+
+// Remove the message at the front of the queue
+void
+websocket_session::
+pop()
+{
+    state_->remove_queued(queue_.front().message.size());
+    queue_.pop_front();
+}
+
+std::shared_ptr<relay>
+websocket_session::
+open_relay()
+{
+    // Anything batched so far goes first
+    flush();
+
+    auto r = std::make_shared<relay>();
+    r->session = shared_from_this();
+    queue_.push_back({shared_buffer(), r});
+    return r;
+}
+
+void
+websocket_session::
+resume()
+{
+    do_write();
+}
+
+void
+websocket_session::
+drained()
+{
+    if(! stalled_ || backlogged())
         return;
 
-    // We are not currently writing, so send this immediately
-    ws_.async_write(
-        net::buffer(*queue_.front()),
-        [sp = shared_from_this()](
-            error_code ec, std::size_t bytes)
+    stalled_ = false;
+#if LOUNGE_COROUTINES
+    spawn(read_loop());
+#else
+    do_read();
+#endif
+}
+
+void
+websocket_session::
+abort()
+{
+    error_code ec;
+    ws_.next_layer().close(ec);
+}
+
+void
+websocket_session::
+close(websocket::close_code code)
+{
+    flush();
+
+    // The close waits for a write in progress
+    ws_.async_close(
+        code,
+        [sp = shared_from_this()](error_code ec)
         {
-            sp->on_write(ec, bytes);
+            if(ec)
+                sp->fail(ec, "close");
         });
 }
 
 void
 websocket_session::
-on_write(error_code ec, std::size_t)
+do_write()
 {
-    // Handle the error, if any
-    if(ec)
-        return fail(ec, "write");
+    // Are we already writing?
+    if(writing_ || queue_.empty())
+        return;
 
-    // Remove the string from the queue
-    queue_.erase(queue_.begin());
+#if LOUNGE_COROUTINES
+    writing_ = true;
+    spawn(write_loop());
+#else
+    auto const& m = queue_.front();
 
-    // Send the next message if any
-    if(! queue_.empty())
+    // Send a complete message
+    if(! m.stream)
+    {
+        writing_ = true;
+        fin_ = true;
         ws_.async_write(
-            net::buffer(*queue_.front()),
+            m.message.buffer(),
             [sp = shared_from_this()](
                 error_code ec, std::size_t bytes)
             {
                 sp->on_write(ec, bytes);
             });
+        return;
+    }
+
+    // Send the next chunk of a relayed message,
+    // or wait for the sender to provide one.
+    auto const& r = *m.stream;
+    if(r.chunks.empty() && ! r.done)
+        return;
+    writing_ = true;
+    fin_ = r.done && r.chunks.size() <= 1;
+    ws_.async_write_some(
+        fin_,
+        r.chunks.empty() ?
+            net::const_buffer{} :
+            r.chunks.front().buffer(),
+        [sp = shared_from_this()](
+            error_code ec, std::size_t bytes)
+        {
+            sp->on_write(ec, bytes);
+        });
+#endif
 }
@@ -12,9 +12,13 @@
 
 #include "net.hpp"
 #include "beast.hpp"
+#include "coro.hpp"
+#include "shared_buffer.hpp"
 #include "shared_state.hpp"
 
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <memory>
 #include <string>
 #include <vector>
@@ -26,15 +30,52 @@ class shared_state;
 */
 class websocket_session : public std::enable_shared_from_this<websocket_session>
 {
-    beast::flat_buffer buffer_;
+    receive_buffer buffer_;
     websocket::stream<tcp::socket> ws_;
     std::shared_ptr<shared_state> state_;
-    std::vector<std::shared_ptr<std::string const>> queue_;
+
+    // An outgoing message, either complete or being relayed
+    struct outgoing
+    {
+        shared_buffer message;
+        std::shared_ptr<relay> stream;
+    };
+
+    std::deque<outgoing> queue_;
+    std::vector<shared_buffer> batch_;
+    std::vector<std::shared_ptr<relay>> relays_;
+    net::steady_timer timer_;
+    net::steady_timer relay_timer_;
+    bool writing_ = false;
+    bool fin_ = false;
+    bool handshaking_ = true;
+    bool relaying_ = false;
+    bool stalled_ = false;
+    std::uint64_t capture_id_ = 0;
+    std::uint64_t message_size_ = 0;
 
     void fail(error_code ec, char const* what);
+    void enqueue(shared_buffer const& message);
+    void pop();
+    void flush();
+    void forward(bool done);
+    bool backlogged() const;
+    void release(relay& r);
+    void wait_relay();
+    void on_relay_timer(error_code ec);
+    std::size_t read_limit() const;
+    void consume(std::size_t bytes_transferred);
+    void do_write();
+    void on_timer(error_code ec);
     void on_accept(error_code ec);
+#if LOUNGE_COROUTINES
+    task<> read_loop();
+    task<> write_loop();
+#else
+    void do_read();
     void on_read(error_code ec, std::size_t bytes_transferred);
     void on_write(error_code ec, std::size_t bytes_transferred);
+#endif
 
 public:
     websocket_session(
@@ -47,9 +88,29 @@ public:
     void
     run(http::request<Body, http::basic_fields<Allocator>> req);
 
-    // Send a message
+    // Send a message, combining it with others if it is batchable
+    void
+    send(shared_buffer const& message, bool batchable);
+
+    // Queue a message which will be streamed through the returned relay
+    std::shared_ptr<relay>
+    open_relay();
+
+    // Continue writing after chunks were added to a relay
+    void
+    resume();
+
+    // Continue reading after a recipient released relayed chunks
+    void
+    drained();
+
+    // Close the connection at once, abandoning anything queued
+    void
+    abort();
+
+    // Send any batched messages, then close the connection
     void
-    send(std::shared_ptr<std::string const> const& ss);
+    close(websocket::close_code code);
 };
 
 template<class Body, class Allocator>